@@ -1,95 +1,373 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
-// cached copies of disk block contents.  Caching disk blocks
+// The buffer cache is a hash table of buf structures holding
+// cached copies of disk block contents, with a spinlock and an
+// LRU list per bucket so that lookups of different blocks
+// proceed in parallel.  Block data lives in pages from kalloc(),
+// BCACHEPCT percent of free memory at boot, and bshrink() gives
+// idle pages back when kalloc() runs out.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
-// a synchronization point for disk blocks used by multiple processes.
+// a synchronization point for disk blocks used by multiple
+// processes.
 //
 // Interface:
 // * To get a buffer for a particular disk block, call bread.
-// * After changing buffer data, call bwrite to write it to disk.
+// * After changing buffer data, call bwrite to write it to disk,
+//     or bwritev to write several at once.
 // * When done with the buffer, call brelse.
 // * Do not use the buffer after calling brelse.
 // * Only one process at a time can use a buffer,
 //     so do not keep them longer than necessary.
+// * bread_async/bwait split a read in two, and bprefetch
+//     starts one that nobody waits for.
 //
-// The implementation uses two state flags internally:
+// The implementation uses three state flags internally:
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+// * B_ASYNC: a bprefetch read; biodone releases the buffer.
 
 #include "types.h"
+#include "mmu.h"
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pstat.h"
 
-struct {
-  struct spinlock lock;
-  struct buf buf[NBUF];
+#define BPERPAGE (PGSIZE/BSIZE)   // buffers sharing a data page
+#define BKPERPAGE (PGSIZE/sizeof(struct bucket))
+#define MAXBKPAGE 256
+#define MINFREE   1024   // free pages needed before bgrow() refills
 
-  // Linked list of all buffers, through prev/next.
+struct bucket {
+  struct spinlock lock;
+  // Linked list of this bucket's buffers, through prev/next.
   // head.next is most recently used.
   struct buf head;
+  uint hits;
+  uint misses;
+  uint evictions;
+};
+
+// A page of block data and the buffers that use it.
+// The page is freed only when all of them are idle.
+struct bpage {
+  uchar *data;                 // 0 if given back to kalloc
+  struct buf buf[BPERPAGE];
+  struct bpage *next;
+};
+
+struct {
+  // Serializes recycling, growing and shrinking, which are
+  // the only code that holds two bucket locks at once.
+  struct spinlock evictlock;
+  struct bucket *bkpage[MAXBKPAGE];
+  int nbucket;
+  int nbuf;                    // buffers with data
+  struct bpage *pages;         // with data, oldest first
+  struct bpage *spare;         // without data
 } bcache;
 
+// The ith bucket.
+static struct bucket*
+bbucket(uint i)
+{
+  return &bcache.bkpage[i / BKPERPAGE][i % BKPERPAGE];
+}
+
+static struct bucket*
+bhash(uint dev, uint blockno)
+{
+  return bbucket((dev * 31 + blockno) % bcache.nbucket);
+}
+
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Insert b at the MRU end of bk.
+static void
+blink(struct bucket *bk, struct buf *b)
+{
+  b->next = bk->head.next;
+  b->prev = &bk->head;
+  bk->head.next->prev = b;
+  bk->head.next = b;
+}
+
+// Give bp's buffers the page data and add them to the cache.
+// Caller holds evictlock, except in binit().
+static void
+bpageadd(struct bpage *bp, uchar *data)
+{
+  struct bpage **pp;
+  struct bucket *bk;
+  struct buf *b;
+
+  bp->data = data;
+  for(b = bp->buf; b < bp->buf+BPERPAGE; b++){
+    b->data = data + (b - bp->buf) * BSIZE;
+    // Unused buffers get distinct fake block numbers
+    // so that they spread over the buckets.
+    b->dev = 0;
+    b->blockno = bcache.nbuf + (b - bp->buf);
+    b->flags = 0;
+    b->refcnt = 0;
+    bk = bhash(b->dev, b->blockno);
+    acquire(&bk->lock);
+    blink(bk, b);
+    release(&bk->lock);
+  }
+  for(pp = &bcache.pages; *pp; pp = &(*pp)->next)
+    ;
+  bp->next = 0;
+  *pp = bp;
+  bcache.nbuf += BPERPAGE;
+}
+
 void
 binit(void)
 {
+  struct bucket *bk;
+  struct bpage *bp;
   struct buf *b;
+  char *mem;
+  int i, npage;
 
-  initlock(&bcache.lock, "bcache");
+  initlock(&bcache.evictlock, "bcache");
+
+  // Use BCACHEPCT percent of free memory for block data, but
+  // at least NBUF buffers, with about one bucket per page.
+  npage = kfreepages() / 100 * BCACHEPCT;
+  if(npage * BPERPAGE < NBUF)
+    npage = (NBUF + BPERPAGE - 1) / BPERPAGE;
+  bcache.nbucket = npage;
+  if(bcache.nbucket > MAXBKPAGE * BKPERPAGE)
+    bcache.nbucket = MAXBKPAGE * BKPERPAGE;
+  for(i = 0; i < bcache.nbucket; i++){
+    if(i % BKPERPAGE == 0 &&
+       (bcache.bkpage[i / BKPERPAGE] = (struct bucket*)kalloc()) == 0)
+      panic("binit: buckets");
+    bk = bbucket(i);
+    initlock(&bk->lock, "bcache.bucket");
+    bk->head.prev = &bk->head;
+    bk->head.next = &bk->head;
+    bk->hits = bk->misses = bk->evictions = 0;
+  }
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+  // No process runs yet, so evictlock is not needed.
+  bp = 0;
+  for(i = 0; i < npage; i++){
+    if(i % (PGSIZE / sizeof(*bp)) == 0 && (bp = (struct bpage*)kalloc()) == 0)
+      break;
+    if((mem = kalloc()) == 0)
+      break;
+    for(b = bp->buf; b < bp->buf+BPERPAGE; b++)
+      initsleeplock(&b->lock, "buffer");
+    bpageadd(bp++, (uchar*)mem);
   }
+  if(bcache.nbuf < NBUF)
+    panic("binit: no memory");
+}
+
+// Give a data page back to kalloc() when memory runs out.
+// Only a page whose buffers are all idle and clean can go,
+// and the cache keeps at least NBUF buffers.
+// Returns 1 if a page was freed.
+int
+bshrink(void)
+{
+  struct bpage *bp, **pp;
+  struct bucket *bk;
+  struct buf *b;
+  int n;
+
+  if(bcache.nbucket == 0)
+    return 0;
+  acquire(&bcache.evictlock);
+  if(bcache.nbuf - BPERPAGE < NBUF){
+    release(&bcache.evictlock);
+    return 0;
+  }
+  for(pp = &bcache.pages; (bp = *pp) != 0; pp = &bp->next){
+    // Unlink idle buffers so that bget() cannot find them,
+    // and put them back if one turns out to be busy.
+    for(n = 0; n < BPERPAGE; n++){
+      b = &bp->buf[n];
+      bk = bhash(b->dev, b->blockno);
+      acquire(&bk->lock);
+      if(b->refcnt != 0 || (b->flags & B_DIRTY)){
+        release(&bk->lock);
+        break;
+      }
+      bunlink(b);
+      release(&bk->lock);
+    }
+    if(n == BPERPAGE){
+      *pp = bp->next;
+      bp->next = bcache.spare;
+      bcache.spare = bp;
+      bcache.nbuf -= BPERPAGE;
+      release(&bcache.evictlock);
+      kfree((char*)bp->data);
+      bp->data = 0;
+      return 1;
+    }
+    while(--n >= 0){
+      b = &bp->buf[n];
+      bk = bhash(b->dev, b->blockno);
+      acquire(&bk->lock);
+      blink(bk, b);
+      release(&bk->lock);
+    }
+  }
+  release(&bcache.evictlock);
+  return 0;
+}
+
+// Give a page shrunk away by bshrink() its data back
+// while there is plenty of free memory.
+static void
+bgrow(void)
+{
+  struct bpage *bp;
+  char *mem;
+
+  if(bcache.spare == 0 || kfreepages() < MINFREE)
+    return;
+  if((mem = kalloc()) == 0)
+    return;
+  acquire(&bcache.evictlock);
+  if((bp = bcache.spare) == 0){
+    release(&bcache.evictlock);
+    kfree(mem);
+    return;
+  }
+  bcache.spare = bp->next;
+  bpageadd(bp, (uchar*)mem);
+  release(&bcache.evictlock);
+}
+
+// Return the cached buffer for dev/blockno in bk, with a
+// reference taken, or 0.  Caller holds bk->lock.
+static struct buf*
+blookup(struct bucket *bk, uint dev, uint blockno)
+{
+  struct buf *b;
+
+  for(b = bk->head.next; b != &bk->head; b = b->next){
+    if(b->dev == dev && b->blockno == blockno){
+      b->refcnt++;
+      return b;
+    }
+  }
+  return 0;
+}
+
+// Least recently used recyclable buffer in bk, or 0.
+// Even if refcnt==0, B_DIRTY indicates a buffer is in use
+// because log.c has modified it but not yet committed it.
+// Caller holds bk->lock.
+static struct buf*
+bvictim(struct bucket *bk)
+{
+  struct buf *b;
+
+  for(b = bk->head.prev; b != &bk->head; b = b->prev)
+    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0)
+      return b;
+  return 0;
 }
 
 // Look through buffer cache for block on device dev.
 // If not found, allocate a buffer.
 // In either case, return locked buffer.
+// With nowait set, return 0 rather than a cached block,
+// so that only a fresh, uncontended buffer is locked, and
+// also return 0 if no buffer is free to recycle.
 static struct buf*
-bget(uint dev, uint blockno)
+bget(uint dev, uint blockno, int nowait)
 {
   struct buf *b;
+  struct bucket *bk, *victim;
+  uint i, start;
 
-  acquire(&bcache.lock);
+  bk = bhash(dev, blockno);
+  acquire(&bk->lock);
 
   // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
-    if(b->dev == dev && b->blockno == blockno){
-      b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  if((b = blookup(bk, dev, blockno)) != 0){
+    if(nowait){
+      b->refcnt--;
+      release(&bk->lock);
+      return 0;
     }
+    bk->hits++;
+    release(&bk->lock);
+    acquiresleep(&b->lock);
+    return b;
   }
+  release(&bk->lock);
 
-  // Not cached; recycle an unused buffer.
-  // Even if refcnt==0, B_DIRTY indicates a buffer is in use
-  // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // Not cached; recycle an unused buffer, preferring this
+  // bucket's own LRU and otherwise stealing from the others.
+  // Another process may have cached the block meanwhile,
+  // so look again once recycling is serialized.
+  bgrow();
+  acquire(&bcache.evictlock);
+  acquire(&bk->lock);
+  if((b = blookup(bk, dev, blockno)) != 0){
+    if(nowait){
+      b->refcnt--;
+      release(&bk->lock);
+      release(&bcache.evictlock);
+      return 0;
+    }
+    bk->hits++;
+    release(&bk->lock);
+    release(&bcache.evictlock);
+    acquiresleep(&b->lock);
+    return b;
+  }
+  bk->misses++;
+  victim = bk;
+  b = bvictim(bk);
+  start = (dev * 31 + blockno) % bcache.nbucket;
+  for(i = 1; b == 0 && i < bcache.nbucket; i++){
+    victim = bbucket((start + i) % bcache.nbucket);
+    acquire(&victim->lock);
+    if((b = bvictim(victim)) != 0){
+      bunlink(b);
+      blink(bk, b);
+    }
+    release(&victim->lock);
+  }
+  if(b == 0){
+    if(nowait){
+      // A read-ahead is only a guess; skip it.
+      release(&bk->lock);
+      release(&bcache.evictlock);
+      return 0;
     }
+    panic("bget: no buffers");
   }
-  panic("bget: no buffers");
+  if(b->flags & B_VALID)
+    bk->evictions++;
+  b->dev = dev;
+  b->blockno = blockno;
+  b->flags = 0;
+  b->refcnt = 1;
+  release(&bk->lock);
+  release(&bcache.evictlock);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -98,13 +376,50 @@ bread(uint dev, uint blockno)
 {
   struct buf *b;
 
-  b = bget(dev, blockno);
+  b = bget(dev, blockno, 0);
   if((b->flags & B_VALID) == 0) {
     iderw(b);
   }
   return b;
 }
 
+// Like bread, but start the disk read without waiting for it.
+// Call bwait before using the data.
+struct buf*
+bread_async(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  b = bget(dev, blockno, 0);
+  if((b->flags & B_VALID) == 0)
+    idesubmit(&b, 1);
+  return b;
+}
+
+// Wait for a read started by bread_async.
+void
+bwait(struct buf *b)
+{
+  if(!holdingsleep(&b->lock))
+    panic("bwait");
+  ideiowait(b);
+}
+
+// Start reading a block that will be wanted soon, if it is
+// not cached.  Never sleeps on another buffer, so the caller
+// may hold buffers of its own.  The buffer is released by
+// biodone when the read finishes.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+
+  if((b = bget(dev, blockno, 1)) == 0)
+    return;
+  b->flags |= B_ASYNC;
+  idesubmit(&b, 1);
+}
+
 // Write b's contents to disk.  Must be locked.
 void
 bwrite(struct buf *b)
@@ -115,8 +430,42 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
+// Write n locked bufs to disk as one batch, so that the
+// driver can sort and merge them, and wait for all of them.
+void
+bwritev(struct buf **bufs, int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++){
+    if(!holdingsleep(&bufs[i]->lock))
+      panic("bwritev");
+    bufs[i]->flags |= B_DIRTY;
+  }
+  iderwv(bufs, n);
+}
+
+// Drop a reference to b, moving it to the head of its
+// bucket's MRU list if it was the last.
+static void
+bput(struct buf *b)
+{
+  struct bucket *bk;
+
+  bk = bhash(b->dev, b->blockno);
+  acquire(&bk->lock);
+  b->refcnt--;
+  if (b->refcnt == 0) {
+    // no one is waiting for it.
+    bunlink(b);
+    blink(bk, b);
+  }
+  
+  release(&bk->lock);
+}
+
 // Release a locked buffer.
-// Move to the head of the MRU list.
+// Move to the head of its bucket's MRU list.
 void
 brelse(struct buf *b)
 {
@@ -124,20 +473,43 @@ brelse(struct buf *b)
     panic("brelse");
 
   releasesleep(&b->lock);
+  bput(b);
+}
 
-  acquire(&bcache.lock);
-  b->refcnt--;
-  if (b->refcnt == 0) {
-    // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+// Called by the disk driver, with its lock held, when the
+// transfer for b has finished.
+void
+biodone(struct buf *b)
+{
+  b->flags |= B_VALID;
+  b->flags &= ~B_DIRTY;
+  if(b->flags & B_ASYNC){
+    // No process waits for a prefetch; give up the
+    // buffer on bprefetch's behalf.
+    b->flags &= ~B_ASYNC;
+    releasesleep(&b->lock);
+    bput(b);
+  } else
+    wakeup(b);
+}
+
+// Sum the per-bucket counters for getbcachestat.
+void
+bstat(struct bcachestat *st)
+{
+  struct bucket *bk;
+  int i;
+
+  st->nbuf = bcache.nbuf;
+  st->hits = st->misses = st->evictions = 0;
+  for(i = 0; i < bcache.nbucket; i++){
+    bk = bbucket(i);
+    acquire(&bk->lock);
+    st->hits += bk->hits;
+    st->misses += bk->misses;
+    st->evictions += bk->evictions;
+    release(&bk->lock);
   }
-  
-  release(&bcache.lock);
 }
 //PAGEBREAK!
 // Blank page.
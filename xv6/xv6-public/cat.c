@@ -7,8 +7,19 @@ char buf[512];
 void
 cat(int fd)
 {
+  struct stat st;
   int n;
 
+  // Unless stdout is the console, let the kernel move file
+  // data itself.  sendfile fails if fd is not a file (say,
+  // a pipe); read and write what is left then.
+  if(fstat(1, &st) >= 0 && st.type != T_DEV){
+    while((n = sendfile(1, fd, -1, 8192)) > 0)
+      ;
+    if(n == 0)
+      return;
+  }
+
   while((n = read(fd, buf, sizeof(buf))) > 0) {
     if (write(1, buf, n) != n) {
       printf(1, "cat: write error\n");
@@ -10,6 +10,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "file.h"
+#include "poll.h"
 #include "memlayout.h"
 #include "mmu.h"
 #include "proc.h"
@@ -184,6 +185,7 @@ struct {
   uint r;  // Read index
   uint w;  // Write index
   uint e;  // Edit index
+  struct waitq pollq;
 } input;
 
 #define C(x)  ((x)-'@')  // Control-x
@@ -221,6 +223,7 @@ consoleintr(int (*getc)(void))
         if(c == '\n' || c == C('D') || input.e == input.r+INPUT_BUF){
           input.w = input.e;
           wakeup(&input.r);
+          pollwakeup(&input.pollq);
         }
       }
       break;
@@ -285,6 +288,23 @@ consolewrite(struct inode *ip, char *buf, int n)
   return n;
 }
 
+// The console can always be written, and can be read
+// once a line is complete.
+int
+consolepoll(struct inode *ip, int events, struct pollent *pe)
+{
+  int r;
+
+  acquire(&cons.lock);
+  r = events & POLLOUT;
+  if(input.r != input.w)
+    r |= events & POLLIN;
+  if(r == 0 && pe)
+    pollwait(&input.pollq, &cons.lock, pe);
+  release(&cons.lock);
+  return r;
+}
+
 void
 consoleinit(void)
 {
@@ -292,6 +312,7 @@ consoleinit(void)
 
   devsw[CONSOLE].write = consolewrite;
   devsw[CONSOLE].read = consoleread;
+  devsw[CONSOLE].poll = consolepoll;
   cons.locking = 1;
 
   ioapicenable(IRQ_KBD, 0);
@@ -6,3 +6,10 @@ struct rtcdate {
   uint month;
   uint year;
 };
+
+#define CLOCK_MONOTONIC 1  // time since boot
+
+struct timespec {
+  uint sec;
+  uint nsec;
+};
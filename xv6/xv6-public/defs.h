@@ -1,20 +1,35 @@
+struct bcachestat;
 struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct lazy;
+struct pcidev;
 struct pipe;
+struct pollent;
 struct proc;
+struct procinfo;
 struct rtcdate;
 struct spinlock;
 struct sleeplock;
 struct stat;
 struct superblock;
+struct timespec;
+struct waitq;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
+struct buf*     bread_async(uint, uint);
+void            bwait(struct buf*);
+void            bprefetch(uint, uint);
+void            biodone(struct buf*);
 void            brelse(struct buf*);
 void            bwrite(struct buf*);
+void            bwritev(struct buf**, int);
+void            bstat(struct bcachestat*);
+int             bshrink(void);
 
 // console.c
 void            consoleinit(void);
@@ -31,12 +46,19 @@ void            fileclose(struct file*);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
+int             filepread(struct file*, char*, int n, uint off);
+int             filereadv(struct file*, struct iovec*, int);
+int             filesendfile(struct file*, struct file*, int, int);
+int             filepoll(struct file*, int, struct pollent*);
+int             filepwrite(struct file*, char*, int n, uint off);
 int             filestat(struct file*, struct stat*);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int);
 
 // fs.c
 void            readsb(int dev, struct superblock *sb);
 int             dirlink(struct inode*, char*, uint);
+void            dcinval(struct inode*, char*);
 struct inode*   dirlookup(struct inode*, char*, uint*);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
@@ -50,6 +72,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readipipe(struct inode*, struct pipe*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -57,14 +80,25 @@ int             writei(struct inode*, char*, uint, uint);
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+void            iderwv(struct buf**, int);
+void            idesubmit(struct buf**, int);
+void            ideiowait(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
 extern uchar    ioapicid;
 void            ioapicinit(void);
+void            ioapicroute(int, int, int);
+
+// virtio.c
+int             virtioinit(void);
+void            virtiointr(void);
+void            virtiosubmit(struct buf**, int);
+void            virtiowait(struct buf*);
 
 // kalloc.c
 char*           kalloc(void);
+int             kfreepages(void);
 void            kfree(char*);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
@@ -78,13 +112,19 @@ int             lapicid(void);
 extern volatile uint*    lapic;
 void            lapiceoi(void);
 void            lapicinit(void);
+void            lapicipi(int, int);
 void            lapicstartap(uchar, uint);
+void            lapictimer(uint);
+uint            lapictimercount(void);
 void            microdelay(int);
 
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
+void            log_force(void);
+int             log_maxop(void);
 void            begin_op();
+void            begin_opn(int);
 void            end_op();
 
 // mp.c
@@ -95,18 +135,47 @@ void            mpinit(void);
 void            picenable(int);
 void            picinit(void);
 
+// pci.c
+int             pcifind(int, int, int, int, struct pcidev*);
+void            pcienable(struct pcidev*);
+uint            pciread(struct pcidev*, int);
+void            pciwrite(struct pcidev*, int, uint);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
+int             pipefcntl(struct pipe*, int, int);
+int             pipegift(struct pipe*, struct lazy*, uint, int);
+int             pipeput(struct pipe*, char*, int);
 int             piperead(struct pipe*, char*, int);
+int             pipereadv(struct pipe*, struct iovec*, int);
+int             pipetake(struct pipe*, struct lazy*, uint, int);
 int             pipewrite(struct pipe*, char*, int);
+int             pipewritev(struct pipe*, struct iovec*, int);
+int             pipewaitroom(struct pipe*);
+int             pipepoll(struct pipe*, int, int, struct pollent*);
+
+// poll.c
+void            polldone(struct pollent*);
+void            pollinit(void);
+void            pollsleep(uint64);
+void            pollstart(void);
+void            pollwait(struct waitq*, struct spinlock*, struct pollent*);
+void            pollwakeup(struct waitq*);
 
 //PAGEBREAK: 16
 // proc.c
+int             clone(void(*)(void*), void*, void*);
 int             cpuid(void);
 void            exit(void);
 int             fork(void);
+int             futexwait(uint, int);
+int             futexwake(uint, int);
+int             getprocinfo(struct procinfo*, int);
+int             grouplive(void);
 int             growproc(int);
+int             join(uint*);
+void            kthread(char*, void (*)(void));
 int             kill(int);
 struct cpu*     mycpu(void);
 struct proc*    myproc();
@@ -116,6 +185,7 @@ void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
 void            sleep(void*, struct spinlock*);
+int             ungroup(void);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
@@ -157,7 +227,14 @@ int             fetchstr(uint, char**);
 void            syscall(void);
 
 // timer.c
+void            clockread(struct timespec*);
+uint64          microtime(void);
+void            timerbusy(void);
+void            timeridle(void);
 void            timerinit(void);
+int             timerintr(void);
+int             timersleep(uint64);
+void            timedsleep(uint64, struct spinlock*);
 
 // trap.c
 void            idtinit(void);
@@ -188,6 +265,9 @@ int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
 int 			mappages(pde_t *pgdir, void* va, uint size, uint pa, int perm);
 pte_t*          walkpgdir(pde_t *pgdir, const void *va, int alloc);
+struct lazy*    wmapregion(uint, uint);
+char*           wmappage(struct lazy*, uint);
+char*           wmapswap(struct lazy*, uint, char*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
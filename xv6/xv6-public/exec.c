@@ -100,7 +100,8 @@ exec(char *path, char **argv)
   curproc->tf->eip = elf.entry;  // main
   curproc->tf->esp = sp;
   switchuvm(curproc);
-  freevm(oldpgdir);
+  if(ungroup() == 0)  // sibling threads keep the old image
+    freevm(oldpgdir);
   return 0;
 
  bad:
@@ -2,3 +2,9 @@
 #define O_WRONLY  0x001
 #define O_RDWR    0x002
 #define O_CREATE  0x200
+
+// fcntl() commands, for pipes
+#define F_GETPIPE_SZ  1   // buffer size in bytes
+#define F_SETPIPE_SZ  2   // resize, rounded up to 2^n pages
+#define F_SETRLOWAT   3   // wake readers once this much is buffered
+#define F_SETWLOWAT   4   // wake writers once this much room is free
@@ -5,10 +5,14 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "stat.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "poll.h"
+#include "uio.h"
 
 struct devsw devsw[NDEV];
 struct {
@@ -112,46 +116,241 @@ fileread(struct file *f, char *addr, int n)
   panic("fileread");
 }
 
+// Read from file f into the cnt buffers in iov, in order.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, n;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_PIPE)
+    return pipereadv(f->pipe, iov, cnt);
+  if(f->type == FD_INODE){
+    n = 0;
+    ilock(f->ip);
+    for(i = 0; i < cnt; i++){
+      if((r = readi(f->ip, iov[i].iov_base, f->off, iov[i].iov_len)) < 0){
+        if(n == 0)
+          n = -1;
+        break;
+      }
+      f->off += r;
+      n += r;
+      if(r < iov[i].iov_len)
+        break;
+    }
+    iunlock(f->ip);
+    return n;
+  }
+  panic("filereadv");
+}
+
+// Read from file f at offset off, leaving f->off alone.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  if(off >= f->ip->size && f->ip->type != T_DEV)
+    r = 0;  // past end of file, as read() would see it
+  else
+    r = readi(f->ip, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
 //PAGEBREAK!
+// Write the cnt buffers in iov to ip at *off, advancing *off.
+// The buffers are written back to back into the file, so
+// they share transactions the way one long write would.
+static int
+inodewritev(struct inode *ip, struct iovec *iov, int cnt, uint *off)
+{
+  int r, j, pos, m, n, n1, left;
+
+  n = 0;
+  for(j = 0; j < cnt; j++)
+    n += iov[j].iov_len;
+
+  // write a few blocks at a time to avoid exceeding
+  // the maximum log transaction size: a data block and
+  // its bitmap block for each block touched, plus the
+  // i-node, the single-indirect block, and the double-
+  // indirect root and child (or two children, where a
+  // chunk crosses from one child into the next).
+  // this really belongs lower down, since writei()
+  // might be writing a device like the console.
+  int max = ((log_maxop()-1-1-1-1) / 2) * BSIZE;
+  int i = 0, nb;
+  j = pos = 0;
+  while(i < n){
+    n1 = n - i;
+    if(*off % BSIZE + n1 > max)
+      n1 = max - *off % BSIZE;
+
+    // reserve only what the blocks this chunk spans can
+    // dirty, but never less than an ordinary op.
+    nb = (*off % BSIZE + n1 + BSIZE-1) / BSIZE;
+    if(nb*2 + 1+1+1+1 < MAXOPBLOCKS)
+      begin_opn(MAXOPBLOCKS);
+    else
+      begin_opn(nb*2 + 1+1+1+1);
+    ilock(ip);
+    for(left = n1; left > 0; left -= m){
+      while(pos == iov[j].iov_len){
+        j++;
+        pos = 0;
+      }
+      m = iov[j].iov_len - pos;
+      if(m > left)
+        m = left;
+      if((r = writei(ip, (char*)iov[j].iov_base + pos, *off, m)) < 0)
+        break;
+      if(r != m)
+        panic("short filewrite");
+      *off += r;
+      pos += r;
+    }
+    iunlock(ip);
+    end_op();
+
+    if(left > 0)
+      break;
+    i += n1;
+  }
+  return i == n ? n : -1;
+}
+
+static int
+inodewrite(struct inode *ip, char *addr, int n, uint *off)
+{
+  struct iovec iov;
+
+  iov.iov_base = addr;
+  iov.iov_len = n;
+  return inodewritev(ip, &iov, 1, off);
+}
+
 // Write to file f.
 int
 filewrite(struct file *f, char *addr, int n)
 {
-  int r;
-
   if(f->writable == 0)
     return -1;
   if(f->type == FD_PIPE)
     return pipewrite(f->pipe, addr, n);
-  if(f->type == FD_INODE){
-    // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
-    // this really belongs lower down, since writei()
-    // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
-    int i = 0;
-    while(i < n){
-      int n1 = n - i;
-      if(n1 > max)
-        n1 = max;
-
-      begin_op();
-      ilock(f->ip);
-      if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
-        f->off += r;
-      iunlock(f->ip);
-      end_op();
+  if(f->type == FD_INODE)
+    return inodewrite(f->ip, addr, n, &f->off);
+  panic("filewrite");
+}
 
+// Write the cnt buffers in iov to file f, in order.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  if(f->writable == 0)
+    return -1;
+  if(f->type == FD_PIPE)
+    return pipewritev(f->pipe, iov, cnt);
+  if(f->type == FD_INODE)
+    return inodewritev(f->ip, iov, cnt, &f->off);
+  panic("filewritev");
+}
+
+// Copy n bytes of in, from off or from in->off if off is
+// negative, to out.  Into a pipe the data goes straight
+// from the buffer cache; otherwise it passes through one
+// kernel page rather than through user memory.
+int
+filesendfile(struct file *out, struct file *in, int off, int n)
+{
+  struct inode *ip;
+  char *page;
+  uint uoff;
+  int r, w, tot;
+
+  if(in->readable == 0 || out->writable == 0 || in->type != FD_INODE)
+    return -1;
+  ip = in->ip;
+  uoff = off < 0 ? in->off : off;
+  tot = r = 0;
+
+  if(out->type == FD_PIPE && ip->type != T_DEV){
+    while(tot < n){
+      if((r = pipewaitroom(out->pipe)) < 0)
+        break;
+      ilock(ip);
+      if(uoff >= ip->size){
+        iunlock(ip);
+        break;
+      }
+      r = readipipe(ip, out->pipe, uoff, n - tot);
+      iunlock(ip);
       if(r < 0)
         break;
-      if(r != n1)
-        panic("short filewrite");
-      i += r;
+      uoff += r;
+      tot += r;
     }
-    return i == n ? n : -1;
+  } else {
+    if((page = kalloc()) == 0)
+      return -1;
+    while(tot < n){
+      ilock(ip);
+      r = readi(ip, page, uoff, n - tot < PGSIZE ? n - tot : PGSIZE);
+      iunlock(ip);
+      if(r <= 0)
+        break;
+      if(out->type == FD_PIPE)
+        w = pipewrite(out->pipe, page, r);
+      else if(out->type == FD_INODE)
+        w = inodewrite(out->ip, page, r, &out->off);
+      else
+        w = -1;
+      if(w != r){
+        r = -1;
+        break;
+      }
+      uoff += r;
+      tot += r;
+    }
+    kfree(page);
   }
-  panic("filewrite");
+
+  if(off < 0)
+    in->off = uoff;
+  return tot == 0 && r < 0 ? -1 : tot;
+}
+
+// Report which of events are ready on f.  If none are, and
+// pe is given, link it where f's next change will wake it.
+int
+filepoll(struct file *f, int events, struct pollent *pe)
+{
+  struct inode *ip;
+
+  if(f->type == FD_PIPE)
+    return pipepoll(f->pipe, f->writable, events, pe);
+  if(f->type == FD_INODE){
+    ip = f->ip;
+    if(ip->type == T_DEV && ip->major >= 0 && ip->major < NDEV &&
+       devsw[ip->major].poll)
+      return devsw[ip->major].poll(ip, events, pe);
+    // Files and directories never make a reader or writer wait.
+    return events & ((f->readable ? POLLIN : 0) | (f->writable ? POLLOUT : 0));
+  }
+  panic("filepoll");
+}
+
+// Write to file f at offset off, leaving f->off alone.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  return inodewrite(f->ip, addr, n, &off);
 }
 
@@ -18,15 +18,39 @@ struct inode {
   uint dev;           // Device number
   uint inum;          // Inode number
   int ref;            // Reference count
+  struct inode *hnext; // icache hash chain
+  struct inode *prev; // LRU list of entries with ref 0
+  struct inode *next;
   struct sleeplock lock; // protects everything below here
   int valid;          // inode has been read from disk?
+  uint nextbn;        // block a sequential readi would read next
+  uint rabn;          // blocks before this have been prefetched
+  uint extbn;         // file blocks extbn..extbn+extlen-1 are
+  uint extaddr;       //   at disk blocks extaddr.., as last
+  uint extlen;        //   found in an indirect block by bmap
+  uint goal;          // disk block to try to allocate next
+  uint prealloc;      // run set aside by writei for bmap,
+  uint nprealloc;     //   and how many blocks are left in it
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
   uint size;
-  uint addrs[NDIRECT+1];
+  uint addrs[NDIRECT+2];
+};
+
+// Procs in poll() waiting for a file to change.
+struct waitq {
+  struct pollent *head;
+};
+
+// One file a proc in poll() is waiting on.
+struct pollent {
+  struct proc *p;
+  struct waitq *q;        // linked on this, or 0
+  struct spinlock *lk;    // protecting q
+  struct pollent *next;
 };
 
 // table mapping major device number to
@@ -34,6 +58,7 @@ struct inode {
 struct devsw {
   int (*read)(struct inode*, char*, int);
   int (*write)(struct inode*, char*, int);
+  int (*poll)(struct inode*, int, struct pollent*);
 };
 
 extern struct devsw devsw[];
@@ -23,6 +23,8 @@
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
+static void dcinit(void);
+static void dcpurge(struct inode*);
 // there should be one superblock per disk device, but we run with
 // only one device
 struct superblock sb; 
@@ -36,6 +38,8 @@ readsb(int dev, struct superblock *sb)
   bp = bread(dev, 1);
   memmove(sb, bp->data, sizeof(*sb));
   brelse(bp);
+  if(sb->bsize != BSIZE)
+    panic("readsb: file system block size");
 }
 
 // Zero a block.
@@ -51,32 +55,120 @@ bzero(int dev, int bno)
 }
 
 // Blocks.
+//
+// An in-memory summary counts the free blocks that each
+// bitmap block describes, so that balloc skips full parts
+// of the disk without reading them.  Allocation starts from
+// a goal block: for a file, the block just past the last one
+// it was given, so that its blocks end up contiguous.
 
-// Allocate a zeroed disk block.
-static uint
-balloc(uint dev)
+static struct {
+  struct spinlock lock;
+  ushort *nfree;   // free blocks in each bitmap block's range
+  uint nbmap;      // number of bitmap blocks
+  uint rotor;      // goal for allocations without one
+} bsum;
+
+// Count free blocks in the bitmap.  Called by iinit.
+static void
+bsuminit(uint dev)
 {
-  int b, bi, m;
+  uint b, bi;
   struct buf *bp;
 
-  bp = 0;
+  initlock(&bsum.lock, "bsum");
+  bsum.nbmap = (sb.size + BPB - 1) / BPB;
+  if(bsum.nbmap > PGSIZE / sizeof(ushort))
+    panic("bsuminit: bitmap too big");
+  if((bsum.nfree = (ushort*)kalloc()) == 0)
+    panic("bsuminit: kalloc");
   for(b = 0; b < sb.size; b += BPB){
     bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
-        bp->data[bi/8] |= m;  // Mark block in use.
-        log_write(bp);
-        brelse(bp);
-        bzero(dev, b + bi);
-        return b + bi;
-      }
-    }
+    bsum.nfree[b/BPB] = 0;
+    for(bi = 0; bi < BPB && b + bi < sb.size; bi++)
+      if((bp->data[bi/8] & (1 << (bi % 8))) == 0)
+        bsum.nfree[b/BPB]++;
     brelse(bp);
   }
+  bsum.rotor = 0;
+}
+
+// Mark up to n free blocks in use, starting with the first
+// free block at or after goal in goal's bitmap block (wrapping
+// around within it) and continuing while the next ones are
+// free.  Returns the first block and sets *n to how many were
+// taken, or returns 0 if the bitmap block is full.
+static uint
+btake(uint dev, uint goal, uint *n)
+{
+  uint base, end, bi, i, k, m;
+  struct buf *bp;
+
+  base = goal - goal % BPB;
+  end = min(BPB, sb.size - base);
+  bp = bread(dev, BBLOCK(base, sb));
+  bi = 0;
+  for(i = 0; i < end; i++){
+    bi = (goal - base + i) % end;
+    m = 1 << (bi % 8);
+    if((bp->data[bi/8] & m) == 0)  // Is block free?
+      break;
+  }
+  if(i == end){
+    brelse(bp);
+    return 0;
+  }
+  for(k = 0; k < *n && bi + k < end; k++){
+    m = 1 << ((bi + k) % 8);
+    if(bp->data[(bi + k)/8] & m)
+      break;
+    bp->data[(bi + k)/8] |= m;  // Mark block in use.
+  }
+  log_write(bp);
+  brelse(bp);
+
+  acquire(&bsum.lock);
+  bsum.nfree[base/BPB] -= k;
+  bsum.rotor = base + bi + k;
+  release(&bsum.lock);
+  *n = k;
+  return base + bi;
+}
+
+// Allocate up to *n contiguous blocks, trying goal first.
+// Sets *n to how many were allocated; they are not zeroed.
+static uint
+ballocn(uint dev, uint goal, uint *n)
+{
+  uint i, bb, want, b;
+
+  if(goal == 0 || goal >= sb.size)
+    goal = bsum.rotor % sb.size;
+  for(i = 0; i < bsum.nbmap; i++){
+    bb = (goal/BPB + i) % bsum.nbmap;
+    if(bsum.nfree[bb] == 0)
+      continue;
+    want = *n;
+    if((b = btake(dev, i == 0 ? goal : bb*BPB, &want)) != 0){
+      *n = want;
+      return b;
+    }
+  }
   panic("balloc: out of blocks");
 }
 
+// Allocate a zeroed disk block, trying goal first.
+static uint
+balloc(uint dev, uint goal)
+{
+  uint b, n;
+
+  n = 1;
+  b = ballocn(dev, goal, &n);
+  bzero(dev, b);
+  return b;
+}
+
 // Free a disk block.
 static void
 bfree(int dev, uint b)
@@ -92,6 +184,10 @@ bfree(int dev, uint b)
   bp->data[bi/8] &= ~m;
   log_write(bp);
   brelse(bp);
+
+  acquire(&bsum.lock);
+  bsum.nfree[b/BPB]++;
+  release(&bsum.lock);
 }
 
 // Inodes.
@@ -124,7 +220,8 @@ bfree(int dev, uint b)
 //   the number of in-memory pointers to the entry (open
 //   files and current directories). iget() finds or
 //   creates a cache entry and increments its ref; iput()
-//   decrements ref.
+//   decrements ref. A free entry keeps its inode until
+//   iget() recycles it, least recently used first.
 //
 // * Valid: the information (type, size, &c) in an inode
 //   cache entry is only correct when ip->valid is 1.
@@ -158,31 +255,101 @@ bfree(int dev, uint b)
 // entries. Since ip->ref indicates whether an entry is free,
 // and ip->dev and ip->inum indicate which i-node an entry
 // holds, one must hold icache.lock while using any of those fields.
+// It also protects the hash chains, the LRU list, and the map
+// of allocated on-disk inodes that ialloc() searches.
 //
 // An ip->lock sleep-lock protects all ip-> fields other than ref,
 // dev, and inum.  One must hold ip->lock in order to
 // read or write that inode's ip->valid, ip->size, ip->type, &c.
 
+#define IPERPAGE (PGSIZE / sizeof(struct inode))
+#define IHASH(dev, inum) (((dev)*31 + (inum)) & (icache.nbucket - 1))
+
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct inode **bucket;  // hash chains, through hnext
+  uint nbucket;           // a power of two
+  // Linked list of entries with ref 0, through prev/next.
+  // lru.next is most recently used.
+  struct inode lru;
+  uchar *imap;            // bit set for each allocated inode
+  uint ihint;             // no free inode below this one
 } icache;
 
+static void
+lruremove(struct inode *ip)
+{
+  ip->next->prev = ip->prev;
+  ip->prev->next = ip->next;
+}
+
+static void
+lruadd(struct inode *ip)
+{
+  ip->next = icache.lru.next;
+  ip->prev = &icache.lru;
+  icache.lru.next->prev = ip;
+  icache.lru.next = ip;
+}
+
 void
 iinit(int dev)
 {
-  int i = 0;
-  
-  initlock(&icache.lock, "icache");
-  for(i = 0; i < NINODE; i++) {
-    initsleeplock(&icache.inode[i].lock, "inode");
-  }
+  struct inode *ip;
+  struct buf *bp;
+  struct dinode *dip;
+  uint i, n, inum;
 
+  initlock(&icache.lock, "icache");
   readsb(dev, &sb);
   cprintf("sb: size %d nblocks %d ninodes %d nlog %d logstart %d\
  inodestart %d bmap start %d\n", sb.size, sb.nblocks,
           sb.ninodes, sb.nlog, sb.logstart, sb.inodestart,
           sb.bmapstart);
+  bsuminit(dev);
+  dcinit();
+
+  // Use ICACHEPCT percent of free memory for inodes, but at
+  // least NINODE and no more than the disk has.
+  n = kfreepages() / 100 * ICACHEPCT * IPERPAGE;
+  if(n > sb.ninodes)
+    n = sb.ninodes;
+  if(n < NINODE)
+    n = NINODE;
+  icache.lru.prev = &icache.lru;
+  icache.lru.next = &icache.lru;
+  ip = 0;
+  for(i = 0; i < n; i++){
+    if(i % IPERPAGE == 0 && (ip = (struct inode*)kalloc()) == 0)
+      panic("iinit: kalloc");
+    memset(ip, 0, sizeof(*ip));
+    initsleeplock(&ip->lock, "inode");
+    lruadd(ip++);
+  }
+
+  // About two entries per hash chain.
+  if((icache.bucket = (struct inode**)kalloc()) == 0)
+    panic("iinit: kalloc");
+  for(icache.nbucket = 1; icache.nbucket < n/2; icache.nbucket <<= 1)
+    if(icache.nbucket == PGSIZE / sizeof(struct inode*))
+      break;
+  memset(icache.bucket, 0, PGSIZE);
+
+  // Note which on-disk inodes are in use.
+  if(sb.ninodes > PGSIZE*8)
+    panic("iinit: too many inodes");
+  if((icache.imap = (uchar*)kalloc()) == 0)
+    panic("iinit: kalloc");
+  memset(icache.imap, 0, PGSIZE);
+  icache.imap[0] = 1;  // inode 0 is not used
+  for(inum = 1; inum < sb.ninodes; inum++){
+    bp = bread(dev, IBLOCK(inum, sb));
+    dip = (struct dinode*)bp->data + inum%IPB;
+    if(dip->type != 0)
+      icache.imap[inum/8] |= 1 << (inum%8);
+    brelse(bp);
+  }
+  icache.ihint = 1;
 }
 
 static struct inode* iget(uint dev, uint inum);
@@ -198,7 +365,18 @@ ialloc(uint dev, short type)
   struct buf *bp;
   struct dinode *dip;
 
-  for(inum = 1; inum < sb.ninodes; inum++){
+  for(;;){
+    // Claim the first inode the map says is free.
+    acquire(&icache.lock);
+    for(inum = icache.ihint; inum < sb.ninodes; inum++)
+      if((icache.imap[inum/8] & (1 << (inum%8))) == 0)
+        break;
+    if(inum >= sb.ninodes)
+      panic("ialloc: no inodes");
+    icache.imap[inum/8] |= 1 << (inum%8);
+    icache.ihint = inum + 1;
+    release(&icache.lock);
+
     bp = bread(dev, IBLOCK(inum, sb));
     dip = (struct dinode*)bp->data + inum%IPB;
     if(dip->type == 0){  // a free inode
@@ -210,7 +388,6 @@ ialloc(uint dev, short type)
     }
     brelse(bp);
   }
-  panic("ialloc: no inodes");
 }
 
 // Copy a modified in-memory inode to disk.
@@ -241,31 +418,39 @@ iupdate(struct inode *ip)
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
   acquire(&icache.lock);
 
   // Is the inode already cached?
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
-      ip->ref++;
+  for(ip = icache.bucket[IHASH(dev, inum)]; ip; ip = ip->hnext){
+    if(ip->dev == dev && ip->inum == inum){
+      if(ip->ref++ == 0)
+        lruremove(ip);
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
-  // Recycle an inode cache entry.
-  if(empty == 0)
+  // Recycle the least recently used free entry.
+  ip = icache.lru.prev;
+  if(ip == &icache.lru)
     panic("iget: no inodes");
-
-  ip = empty;
+  lruremove(ip);
+  if(ip->inum != 0){
+    for(pp = &icache.bucket[IHASH(ip->dev, ip->inum)]; *pp != ip; pp = &(*pp)->hnext)
+      ;
+    *pp = ip->hnext;
+  }
+  ip->hnext = icache.bucket[IHASH(dev, inum)];
+  icache.bucket[IHASH(dev, inum)] = ip;
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
   ip->valid = 0;
+  ip->nextbn = ip->rabn = 0;
+  ip->extlen = 0;
+  ip->goal = ip->nprealloc = 0;
   release(&icache.lock);
 
   return ip;
@@ -338,16 +523,24 @@ iput(struct inode *ip)
     release(&icache.lock);
     if(r == 1){
       // inode has no links and no other references: truncate and free.
+      if(ip->type == T_DIR)
+        dcpurge(ip);
       itrunc(ip);
       ip->type = 0;
       iupdate(ip);
       ip->valid = 0;
+      acquire(&icache.lock);
+      icache.imap[ip->inum/8] &= ~(1 << (ip->inum%8));
+      if(ip->inum < icache.ihint)
+        icache.ihint = ip->inum;
+      release(&icache.lock);
     }
   }
   releasesleep(&ip->lock);
 
   acquire(&icache.lock);
-  ip->ref--;
+  if(--ip->ref == 0)
+    lruadd(ip);
   release(&icache.lock);
 }
 
@@ -365,35 +558,91 @@ iunlockput(struct inode *ip)
 // The content (data) associated with each inode is stored
 // in blocks on the disk. The first NDIRECT block numbers
 // are listed in ip->addrs[].  The next NINDIRECT blocks are
-// listed in block ip->addrs[NDIRECT].
+// listed in block ip->addrs[NDIRECT].  The NDINDIRECT blocks
+// after that are listed in the NINDIRECT blocks whose numbers
+// are listed in block ip->addrs[NDIRECT+1].
+//
+// Blocks of a file written sequentially tend to be contiguous
+// on disk, so bmap remembers the run of contiguous entries it
+// last found in an indirect block and maps the rest of the run
+// without reading the indirect block again.
+
+// Allocate a zeroed block for ip: from the run writei set
+// aside, if any is left, else just past ip's last block.
+static uint
+bmapalloc(struct inode *ip)
+{
+  uint b;
+
+  if(ip->nprealloc > 0){
+    b = ip->prealloc++;
+    ip->nprealloc--;
+    bzero(ip->dev, b);
+  } else
+    b = balloc(ip->dev, ip->goal);
+  ip->goal = b + 1;
+  return b;
+}
+
+// Return entry i of indirect block addr, allocating a block
+// for it if it is zero.  If the entries are data blocks (bn is
+// not 0), the ones from i on that point at contiguous blocks
+// are remembered as the run starting at file block bn.
+static uint
+indirect(struct inode *ip, uint addr, uint i, uint bn)
+{
+  uint *a, j;
+  struct buf *bp;
+
+  bp = bread(ip->dev, addr);
+  a = (uint*)bp->data;
+  if((addr = a[i]) == 0){
+    a[i] = addr = bmapalloc(ip);
+    log_write(bp);
+  }
+  if(bn != 0){
+    for(j = i+1; j < NINDIRECT && a[j] == a[j-1] + 1; j++)
+      ;
+    ip->extbn = bn;
+    ip->extaddr = addr;
+    ip->extlen = j - i;
+  }
+  brelse(bp);
+  return addr;
+}
 
 // Return the disk block address of the nth block in inode ip.
 // If there is no such block, bmap allocates one.
 static uint
 bmap(struct inode *ip, uint bn)
 {
-  uint addr, *a;
-  struct buf *bp;
+  uint addr, fbn;
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = bmapalloc(ip);
     return addr;
   }
+  if(bn - ip->extbn < ip->extlen)
+    return ip->extaddr + (bn - ip->extbn);
+  fbn = bn;
   bn -= NDIRECT;
 
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
-    bp = bread(ip->dev, addr);
-    a = (uint*)bp->data;
-    if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
-      log_write(bp);
-    }
-    brelse(bp);
-    return addr;
+      ip->addrs[NDIRECT] = addr = bmapalloc(ip);
+    return indirect(ip, addr, bn, fbn);
+  }
+  bn -= NINDIRECT;
+
+  if(bn < NDINDIRECT){
+    // Load the double-indirect block, then the indirect
+    // block it lists, allocating either if necessary.
+    if((addr = ip->addrs[NDIRECT+1]) == 0)
+      ip->addrs[NDIRECT+1] = addr = bmapalloc(ip);
+    addr = indirect(ip, addr, bn / NINDIRECT, 0);
+    return indirect(ip, addr, bn % NINDIRECT, fbn);
   }
 
   panic("bmap: out of range");
@@ -407,10 +656,11 @@ bmap(struct inode *ip, uint bn)
 static void
 itrunc(struct inode *ip)
 {
-  int i, j;
-  struct buf *bp;
-  uint *a;
+  int i, j, k;
+  struct buf *bp, *bp2;
+  uint *a, *a2;
 
+  ip->extlen = 0;
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
       bfree(ip->dev, ip->addrs[i]);
@@ -430,6 +680,26 @@ itrunc(struct inode *ip)
     ip->addrs[NDIRECT] = 0;
   }
 
+  if(ip->addrs[NDIRECT+1]){
+    bp = bread(ip->dev, ip->addrs[NDIRECT+1]);
+    a = (uint*)bp->data;
+    for(j = 0; j < NINDIRECT; j++){
+      if(a[j] == 0)
+        continue;
+      bp2 = bread(ip->dev, a[j]);
+      a2 = (uint*)bp2->data;
+      for(k = 0; k < NINDIRECT; k++){
+        if(a2[k])
+          bfree(ip->dev, a2[k]);
+      }
+      brelse(bp2);
+      bfree(ip->dev, a[j]);
+    }
+    brelse(bp);
+    bfree(ip->dev, ip->addrs[NDIRECT+1]);
+    ip->addrs[NDIRECT+1] = 0;
+  }
+
   ip->size = 0;
   iupdate(ip);
 }
@@ -446,14 +716,48 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Sequential reads prefetch up to RAHEAD blocks past the
+// one being read, topping up once half of them are used.
+#define RAHEAD 16
+
+// Note that readi is reading block bn of ip and, if access
+// looks sequential, fill ra with the disk blocks to prefetch.
+// Returns how many.  bmap may read an indirect block, so this
+// runs before readi locks the buffer for bn.
+// Caller must hold ip->lock.
+static int
+readahead(struct inode *ip, uint bn, uint *ra)
+{
+  uint end;
+  int n;
+
+  if(bn != 0 && bn != ip->nextbn && bn + 1 != ip->nextbn){
+    ip->nextbn = bn + 1;
+    ip->rabn = bn + 1;
+    return 0;
+  }
+  ip->nextbn = bn + 1;
+  if(ip->rabn < bn + 1)
+    ip->rabn = bn + 1;
+  if(ip->rabn >= bn + 1 + RAHEAD/2)
+    return 0;
+  end = (ip->size + BSIZE - 1) / BSIZE;
+  if(end > bn + 1 + RAHEAD)
+    end = bn + 1 + RAHEAD;
+  for(n = 0; ip->rabn < end; ip->rabn++)
+    ra[n++] = bmap(ip, ip->rabn);
+  return n;
+}
+
 //PAGEBREAK!
 // Read data from inode.
 // Caller must hold ip->lock.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, ra[RAHEAD];
   struct buf *bp;
+  int i, nra;
 
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
@@ -467,7 +771,13 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE));
+    // Start the read of this block, prefetch the next ones,
+    // and only then wait.
+    nra = readahead(ip, off/BSIZE, ra);
+    bp = bread_async(ip->dev, bmap(ip, off/BSIZE));
+    for(i = 0; i < nra; i++)
+      bprefetch(ip->dev, ra[i]);
+    bwait(bp);
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
     brelse(bp);
@@ -475,13 +785,48 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   return n;
 }
 
+// Copy up to n bytes of ip at off straight from the buffer
+// cache into pipe p, stopping rather than waiting when p
+// fills up.  Returns the number of bytes copied, or -1 if
+// nothing could be.  Caller must hold ip->lock.
+int
+readipipe(struct inode *ip, struct pipe *p, uint off, uint n)
+{
+  uint tot, m, ra[RAHEAD];
+  struct buf *bp;
+  int i, r, nra;
+
+  if(ip->type == T_DEV || off > ip->size || off + n < off)
+    return -1;
+  if(off + n > ip->size)
+    n = ip->size - off;
+
+  for(tot=0; tot<n; tot+=r, off+=r){
+    nra = readahead(ip, off/BSIZE, ra);
+    bp = bread_async(ip->dev, bmap(ip, off/BSIZE));
+    for(i = 0; i < nra; i++)
+      bprefetch(ip->dev, ra[i]);
+    bwait(bp);
+    m = min(n - tot, BSIZE - off%BSIZE);
+    r = pipeput(p, (char*)bp->data + off%BSIZE, m);
+    brelse(bp);
+    if(r < 0)
+      return tot > 0 ? tot : -1;
+    if(r < m){
+      tot += r;
+      break;
+    }
+  }
+  return tot;
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
 int
 writei(struct inode *ip, char *src, uint off, uint n)
 {
-  uint tot, m;
+  uint tot, m, first, last;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -492,9 +837,18 @@ writei(struct inode *ip, char *src, uint off, uint n)
 
   if(off > ip->size || off + n < off)
     return -1;
-  if(off + n > MAXFILE*BSIZE)
+  if((uint64)off + n > (uint64)MAXFILE*BSIZE)
     return -1;
 
+  // Set aside a contiguous run for the blocks this write
+  // adds to the file, and give back what bmap did not use.
+  first = (ip->size + BSIZE - 1) / BSIZE;
+  last = (off + n + BSIZE - 1) / BSIZE;
+  if(last > first + 1){
+    ip->nprealloc = last - first;
+    ip->prealloc = ballocn(ip->dev, ip->goal, &ip->nprealloc);
+  }
+
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
@@ -503,6 +857,9 @@ writei(struct inode *ip, char *src, uint off, uint n)
     brelse(bp);
   }
 
+  for(; ip->nprealloc > 0; ip->nprealloc--)
+    bfree(ip->dev, ip->prealloc++);
+
   if(n > 0 && off > ip->size){
     ip->size = off;
     iupdate(ip);
@@ -519,6 +876,277 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
+// The name cache remembers what dirlookup() found: the inode
+// number and dirent offset of a name in a directory, or that
+// the name is not there (inum 0).  Entries are hashed by
+// directory and name and recycled least recently used first.
+// dirlink() and sys_unlink() keep them up to date, and iput()
+// drops a directory's entries when it frees the directory.
+
+#define NDHASH 64
+
+struct dentry {
+  uint dev;
+  uint dir;                 // inum of the directory; 0 if unused
+  char name[DIRSIZ];
+  uint inum;                // 0 if name is not in dir
+  uint off;                 // offset of name's dirent
+  struct dentry *hnext;     // hash chain
+  struct dentry *prev;      // LRU list
+  struct dentry *next;
+};
+
+static struct {
+  struct spinlock lock;
+  struct dentry entry[NDENTRY];
+  struct dentry *bucket[NDHASH];
+  // lru.next is most recently used.
+  struct dentry lru;
+} dcache;
+
+static void
+dcinit(void)
+{
+  struct dentry *d;
+
+  initlock(&dcache.lock, "dcache");
+  dcache.lru.prev = &dcache.lru;
+  dcache.lru.next = &dcache.lru;
+  for(d = dcache.entry; d < dcache.entry+NDENTRY; d++){
+    d->next = dcache.lru.next;
+    d->prev = &dcache.lru;
+    dcache.lru.next->prev = d;
+    dcache.lru.next = d;
+  }
+}
+
+static uint
+dhash(uint dir, char *name)
+{
+  uint h;
+  int i;
+
+  h = dir;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + name[i];
+  return h % NDHASH;
+}
+
+// Find dir's entry for name.  Caller holds dcache.lock.
+static struct dentry*
+dfind(uint dev, uint dir, char *name)
+{
+  struct dentry *d;
+
+  for(d = dcache.bucket[dhash(dir, name)]; d; d = d->hnext)
+    if(d->dev == dev && d->dir == dir && namecmp(d->name, name) == 0)
+      return d;
+  return 0;
+}
+
+// Unhash d and make it the next to be recycled.
+// Caller holds dcache.lock.
+static void
+dremove(struct dentry *d)
+{
+  struct dentry **pp;
+
+  for(pp = &dcache.bucket[dhash(d->dir, d->name)]; *pp != d; pp = &(*pp)->hnext)
+    ;
+  *pp = d->hnext;
+  d->dir = 0;
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->prev = dcache.lru.prev;
+  d->next = &dcache.lru;
+  dcache.lru.prev->next = d;
+  dcache.lru.prev = d;
+}
+
+// Look name up in dp's cached entries.  Returns 1 and sets
+// *inum and *off if it is there (*inum 0 for a miss).
+static int
+dcget(struct inode *dp, char *name, uint *inum, uint *off)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    release(&dcache.lock);
+    return 0;
+  }
+  *inum = d->inum;
+  *off = d->off;
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.lru.next;
+  d->prev = &dcache.lru;
+  dcache.lru.next->prev = d;
+  dcache.lru.next = d;
+  release(&dcache.lock);
+  return 1;
+}
+
+// Remember that name is at off in dp, as inum (0 for a miss).
+static void
+dcput(struct inode *dp, char *name, uint inum, uint off)
+{
+  struct dentry *d;
+  uint h;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) == 0){
+    d = dcache.lru.prev;
+    if(d->dir != 0)
+      dremove(d);
+    d->dev = dp->dev;
+    d->dir = dp->inum;
+    strncpy(d->name, name, DIRSIZ);
+    h = dhash(d->dir, d->name);
+    d->hnext = dcache.bucket[h];
+    dcache.bucket[h] = d;
+  }
+  d->inum = inum;
+  d->off = off;
+  d->next->prev = d->prev;
+  d->prev->next = d->next;
+  d->next = dcache.lru.next;
+  d->prev = &dcache.lru;
+  dcache.lru.next->prev = d;
+  dcache.lru.next = d;
+  release(&dcache.lock);
+}
+
+// Forget dp's entry for name, which has been removed.
+void
+dcinval(struct inode *dp, char *name)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  if((d = dfind(dp->dev, dp->inum, name)) != 0)
+    dremove(d);
+  release(&dcache.lock);
+}
+
+// Forget every entry of directory dp, which is being freed.
+static void
+dcpurge(struct inode *dp)
+{
+  struct dentry *d;
+
+  acquire(&dcache.lock);
+  for(d = dcache.entry; d < dcache.entry+NDENTRY; d++)
+    if(d->dir == dp->inum && d->dev == dp->dev)
+      dremove(d);
+  release(&dcache.lock);
+}
+
+// Hashed directories.  See DIRHASH in fs.h.
+
+static char dirzero[BSIZE];
+
+// Is the part of dp past the first DIRLINEAR blocks hashed?
+static int
+dirhashed(struct inode *dp)
+{
+  return dp->major == DIRHASH && dp->size > DIRLINEAR*BSIZE;
+}
+
+// How many bytes at the start of dp to search linearly.
+static uint
+dirlinear(struct inode *dp)
+{
+  return dirhashed(dp) ? DIRLINEAR*BSIZE : dp->size;
+}
+
+static uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 0;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + name[i];
+  return h % NDIRBUCKET;
+}
+
+// Read or write the dirent-sized record at off in dp.
+static void
+dirrw(struct inode *dp, void *p, uint off, int write)
+{
+  int n;
+
+  if(write)
+    n = writei(dp, p, off, sizeof(struct dirent));
+  else
+    n = readi(dp, p, off, sizeof(struct dirent));
+  if(n != sizeof(struct dirent))
+    panic("dirrw");
+}
+
+// Look for name in its bucket of dp.  Returns its inum and
+// sets *poff, or returns 0.
+static uint
+dirhlookup(struct inode *dp, char *name, uint *poff)
+{
+  struct dirmap m;
+  struct dirent de;
+  uint b, fbn, off;
+
+  b = dirhash(name);
+  dirrw(dp, &m, DIRLINEAR*BSIZE + b/3*sizeof(m), 0);
+  for(fbn = m.fbn[b%3]; fbn != 0; fbn = m.fbn[0]){
+    for(off = fbn*BSIZE + sizeof(de); off < (fbn+1)*BSIZE; off += sizeof(de)){
+      dirrw(dp, &de, off, 0);
+      if(de.inum != 0 && namecmp(name, de.name) == 0){
+        *poff = off;
+        return de.inum;
+      }
+    }
+    dirrw(dp, &m, fbn*BSIZE, 0);
+  }
+  return 0;
+}
+
+// Return the offset of a free dirent in name's bucket of dp,
+// adding the map and a bucket block if need be.
+static uint
+dirhslot(struct inode *dp, char *name)
+{
+  struct dirmap m;
+  struct dirent de;
+  uint b, fbn, off, moff, slot;
+
+  if(dp->size == DIRLINEAR*BSIZE && writei(dp, dirzero, dp->size, BSIZE) != BSIZE)
+    panic("dirhslot: map");
+
+  // moff and slot locate the link that leads to fbn.
+  b = dirhash(name);
+  moff = DIRLINEAR*BSIZE + b/3*sizeof(m);
+  slot = b%3;
+  dirrw(dp, &m, moff, 0);
+  while((fbn = m.fbn[slot]) != 0){
+    for(off = fbn*BSIZE + sizeof(de); off < (fbn+1)*BSIZE; off += sizeof(de)){
+      dirrw(dp, &de, off, 0);
+      if(de.inum == 0)
+        return off;
+    }
+    moff = fbn*BSIZE;
+    slot = 0;
+    dirrw(dp, &m, moff, 0);
+  }
+
+  // Chain a new block to the end of the bucket.
+  fbn = dp->size / BSIZE;
+  if(writei(dp, dirzero, dp->size, BSIZE) != BSIZE)
+    panic("dirhslot: bucket");
+  m.fbn[slot] = fbn;
+  dirrw(dp, &m, moff, 1);
+  return fbn*BSIZE + sizeof(de);
+}
+
 // Look for a directory entry in a directory.
 // If found, set *poff to byte offset of entry.
 struct inode*
@@ -530,21 +1158,29 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   if(dp->type != T_DIR)
     panic("dirlookup not DIR");
 
-  for(off = 0; off < dp->size; off += sizeof(de)){
-    if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
-      panic("dirlookup read");
-    if(de.inum == 0)
-      continue;
-    if(namecmp(name, de.name) == 0){
-      // entry matches path element
-      if(poff)
-        *poff = off;
-      inum = de.inum;
-      return iget(dp->dev, inum);
+  if(!dcget(dp, name, &inum, &off)){
+    inum = 0;
+    for(off = 0; off < dirlinear(dp); off += sizeof(de)){
+      if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
+        panic("dirlookup read");
+      if(de.inum == 0)
+        continue;
+      if(namecmp(name, de.name) == 0){
+        // entry matches path element
+        inum = de.inum;
+        break;
+      }
     }
+    if(inum == 0 && dirhashed(dp))
+      inum = dirhlookup(dp, name, &off);
+    dcput(dp, name, inum, off);
   }
 
-  return 0;
+  if(inum == 0)
+    return 0;
+  if(poff)
+    *poff = off;
+  return iget(dp->dev, inum);
 }
 
 // Write a new directory entry (name, inum) into the directory dp.
@@ -562,17 +1198,20 @@ dirlink(struct inode *dp, char *name, uint inum)
   }
 
   // Look for an empty dirent.
-  for(off = 0; off < dp->size; off += sizeof(de)){
+  for(off = 0; off < dirlinear(dp); off += sizeof(de)){
     if(readi(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
       panic("dirlink read");
     if(de.inum == 0)
       break;
   }
+  if(off == DIRLINEAR*BSIZE && dp->major == DIRHASH)
+    off = dirhslot(dp, name);
 
   strncpy(de.name, name, DIRSIZ);
   de.inum = inum;
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("dirlink");
+  dcput(dp, name, inum, off);
 
   return 0;
 }
@@ -8,7 +8,9 @@
 
 
 #define ROOTINO 1  // root i-number
-#define BSIZE 512  // block size
+#ifndef BSIZE
+#define BSIZE 512  // block size; set by the Makefile
+#endif
 
 // Disk layout:
 // [ boot block | super block | log | inode blocks |
@@ -24,11 +26,13 @@ struct superblock {
   uint logstart;     // Block number of first log block
   uint inodestart;   // Block number of first inode block
   uint bmapstart;    // Block number of first free map block
+  uint bsize;        // Block size (bytes)
 };
 
-#define NDIRECT 12
+#define NDIRECT 11
 #define NINDIRECT (BSIZE / sizeof(uint))
-#define MAXFILE (NDIRECT + NINDIRECT)
+#define NDINDIRECT (NINDIRECT * NINDIRECT)
+#define MAXFILE (NDIRECT + NINDIRECT + NDINDIRECT)
 
 // On-disk inode structure
 struct dinode {
@@ -37,7 +41,7 @@ struct dinode {
   short minor;          // Minor device number (T_DEV only)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
-  uint addrs[NDIRECT+1];   // Data block addresses
+  uint addrs[NDIRECT+2];   // Data block addresses
 };
 
 // Inodes per block.
@@ -60,4 +64,21 @@ struct dirent {
   char name[DIRSIZ];
 };
 
+// A directory whose major is DIRHASH is hashed once it outgrows
+// DIRLINEAR blocks of dirents.  The block after those is a map
+// from NDIRBUCKET name hashes to the file block that starts each
+// bucket, and each bucket block links to the next through its
+// first dirent.  The map and the links are dirmaps, which have
+// inum 0 so that programs reading the directory skip them.
+#define DIRHASH     1
+#define DIRLINEAR   2
+#define DPB         (BSIZE / sizeof(struct dirent))
+#define NDIRBUCKET  (DPB * 3)
+
+struct dirmap {
+  ushort inum;          // always 0
+  ushort pad;
+  uint fbn[3];          // file block numbers; 0 for none
+};
+
 #endif /* FS_H */
@@ -1,4 +1,6 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// Simple IDE driver code.  Transfers use bus-master DMA when
+// the controller supports it, and PIO otherwise.
+// Adjacent queued blocks are merged into multi-sector commands.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +14,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,15 +26,49 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_SETMUL 0xc6
+
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
+
+#define IDE_MULT      16    // sectors per RDMUL/WRMUL interrupt
+
+// Bus master IDE registers for the primary channel,
+// at offsets from the controller's PCI BAR4.
+#define BM_CMD        0
+  #define BM_START      0x01
+  #define BM_READ       0x08  // device to memory
+#define BM_STATUS     2
+  #define BM_ERR        0x02
+  #define BM_INTR       0x04  // write 1 to clear
+#define BM_PRDT       4     // physical address of the PRD table
+
+#define NPRD          32    // blocks per DMA command
+
+// Physical region descriptor: one physically contiguous
+// piece of a DMA transfer.
+struct prd {
+  uint addr;
+  ushort len;
+  ushort flags;
+};
+#define PRD_EOT       0x8000  // last entry of the table
 
 // idequeue points to the buf now being read/written to the disk.
 // idequeue->qnext points to the next buf to be processed.
+// The first idecount bufs are adjacent blocks that are being
+// transferred by one command; the rest are in elevator order.
 // You must hold idelock while manipulating queue.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
+static int idecount;
 
 static int havedisk1;
+static int usevirtio;    // disk 1 is a virtio-blk device
+static int idemult[2];   // sectors per interrupt if SETMUL worked
+static ushort idebm;     // bus master ports, or 0 to use PIO
+static struct prd *prdt; // PRD table, in its own page
 static void idestart(struct buf*);
 
 // Wait for IDE disk to become ready.
@@ -47,12 +84,27 @@ idewait(int checkerr)
   return 0;
 }
 
+// Ask disk d to move IDE_MULT sectors per interrupt, so that
+// up to that many can go in one RDMUL/WRMUL command.
+static void
+idesetmul(int d)
+{
+  outb(0x1f6, 0xe0 | (d<<4));
+  idewait(0);
+  outb(0x1f2, IDE_MULT);
+  outb(0x1f7, IDE_CMD_SETMUL);
+  if(idewait(1) >= 0)
+    idemult[d] = IDE_MULT;
+}
+
 void
 ideinit(void)
 {
+  struct pcidev pd;
   int i;
 
   initlock(&idelock, "ide");
+  usevirtio = virtioinit() == 0;
   ioapicenable(IRQ_IDE, ncpu - 1);
   idewait(0);
 
@@ -65,35 +117,101 @@ ideinit(void)
     }
   }
 
+  // Use bus-master DMA if the controller is a PCI IDE
+  // function with a bus master BAR; otherwise PIO.
+  if(pcifind(PCI_ANY, PCI_ANY, PCI_STORAGE, PCI_STORAGE_IDE, &pd) == 0 &&
+     (pd.bar[4] & 1) && (prdt = (struct prd*)kalloc()) != 0){
+    idebm = pd.bar[4] & ~3;
+    pcienable(&pd);
+  }
+
+  outb(0x3f6, 2);  // no interrupts for SETMUL
+  idesetmul(0);
+  if(havedisk1)
+    idesetmul(1);
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Move the data of the n bufs starting at b through the data
+// port.  The device asks for it a DRQ block at a time: mult
+// sectors under RDMUL/WRMUL, else one sector.  The caller has
+// waited for the first; wait for each of the others.
+static int
+idepio(struct buf *b, int n, int write)
+{
+  int s, spb, drq;
+
+  spb = BSIZE/SECTOR_SIZE;
+  drq = idemult[b->dev&1] ? idemult[b->dev&1] : 1;
+  for(s = 0; s < n*spb; s++){
+    if(s > 0 && s % drq == 0 && idewait(1) < 0)
+      return -1;
+    if(s > 0 && s % spb == 0)
+      b = b->qnext;
+    if(write)
+      outsl(0x1f0, b->data + (s % spb)*SECTOR_SIZE, SECTOR_SIZE/4);
+    else
+      insl(0x1f0, b->data + (s % spb)*SECTOR_SIZE, SECTOR_SIZE/4);
+  }
+  return 0;
+}
+
+// Start the request for b, together with the bufs queued
+// after it for the following blocks in the same direction.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *r;
+  int i, n, max;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
-    panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  int mult = idemult[b->dev&1];
+  int read_cmd = idebm ? IDE_CMD_RDDMA : mult ? IDE_CMD_RDMUL : IDE_CMD_READ;
+  int write_cmd = idebm ? IDE_CMD_WRDMA : mult ? IDE_CMD_WRMUL : IDE_CMD_WRITE;
+
+  if (sector_per_block * NPRD > 256) panic("idestart");  // 8-bit sector count
 
-  if (sector_per_block > 7) panic("idestart");
+  // Without DMA, merge no more than one interrupt's worth.
+  max = idebm ? NPRD : mult > sector_per_block ? mult / sector_per_block : 1;
+  for(n = 1, r = b; n < max && r->qnext; n++, r = r->qnext){
+    if(r->qnext->dev != b->dev || r->qnext->blockno != r->blockno + 1 ||
+       (r->qnext->flags & B_DIRTY) != (b->flags & B_DIRTY))
+      break;
+  }
+  idecount = n;
+
+  if(idebm){
+    // One PRD entry per buf; each buf's data is
+    // physically contiguous within a page.
+    for(i = 0, r = b; i < n; i++, r = r->qnext){
+      prdt[i].addr = V2P(r->data);
+      prdt[i].len = BSIZE;
+      prdt[i].flags = (i == n-1) ? PRD_EOT : 0;
+    }
+    outl(idebm + BM_PRDT, V2P(prdt));
+    outb(idebm + BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_READ);
+    outb(idebm + BM_STATUS, inb(idebm + BM_STATUS) | BM_ERR | BM_INTR);
+  }
 
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, n * sector_per_block);  // number of sectors; 0 means 256
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(idebm){
+    outb(0x1f7, (b->flags & B_DIRTY) ? write_cmd : read_cmd);
+    outb(idebm + BM_CMD, inb(idebm + BM_CMD) | BM_START);
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    idepio(b, n, 1);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -104,24 +222,41 @@ void
 ideintr(void)
 {
   struct buf *b;
+  uchar st;
 
-  // First queued buffer is the active request.
+  // First idecount queued buffers are the active request.
   acquire(&idelock);
 
   if((b = idequeue) == 0){
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(idebm){
+    // The data is already in place; stop the engine and
+    // check for errors.  On one, retry the request with PIO.
+    outb(idebm + BM_CMD, 0);
+    st = inb(idebm + BM_STATUS);
+    outb(idebm + BM_STATUS, st | BM_ERR | BM_INTR);
+    if((st & BM_ERR) || idewait(1) < 0){
+      cprintf("ide: dma error, using pio\n");
+      idebm = 0;
+      idestart(b);
+      release(&idelock);
+      return;
+    }
+  } else {
+    // Read data if needed.
+    if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
+      idepio(b, idecount, 0);
+  }
+  for(; idecount > 0; idecount--){
+    b = idequeue;
+    idequeue = b->qnext;
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+    // Wake process waiting for this buf.
+    biodone(b);
+  }
 
   // Start disk on next buf in queue.
   if(idequeue != 0)
@@ -131,38 +266,99 @@ ideintr(void)
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Insert b into idequeue after the active request, in C-LOOK
+// elevator order: blocks at or above the active one ascending,
+// then those below it, ascending, for the next sweep.
+static void
+idequeueadd(struct buf *b)
+{
+  struct buf **pp;
+  uint pos;
+  int i;
+
+  pos = idequeue ? idequeue->blockno : 0;
+  pp = &idequeue;
+  for(i = 0; i < idecount; i++)
+    pp = &(*pp)->qnext;
+  for(; *pp; pp = &(*pp)->qnext){
+    if(((*pp)->blockno < pos) > (b->blockno < pos))
+      break;
+    if(((*pp)->blockno < pos) == (b->blockno < pos) && (*pp)->blockno > b->blockno)
+      break;
+  }
+  b->qnext = *pp;
+  *pp = b;
+}
+
+// Queue bufs for the disk without waiting; adjacent blocks
+// queued together can share a command.  The driver calls
+// biodone for each as it finishes.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
 void
-iderw(struct buf *b)
+idesubmit(struct buf **bufs, int n)
 {
-  struct buf **pp;
+  struct buf *b;
+  int i;
 
-  if(!holdingsleep(&b->lock))
-    panic("iderw: buf not locked");
-  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
-    panic("iderw: nothing to do");
-  if(b->dev != 0 && !havedisk1)
-    panic("iderw: ide disk 1 not present");
+  for(i = 0; i < n; i++){
+    b = bufs[i];
+    if(!holdingsleep(&b->lock))
+      panic("iderw: buf not locked");
+    if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+      panic("iderw: nothing to do");
+    if(b->dev != 0 && !havedisk1 && !usevirtio)
+      panic("iderw: ide disk 1 not present");
+    if(b->blockno >= FSSIZE)
+      panic("incorrect blockno");
+  }
+
+  if(n > 0 && usevirtio && bufs[0]->dev == 1){
+    virtiosubmit(bufs, n);
+    return;
+  }
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
-  b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  for(i = 0; i < n; i++)
+    idequeueadd(bufs[i]);  //DOC:insert-queue
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(idecount == 0 && idequeue)
+    idestart(idequeue);
+
+  release(&idelock);
+}
 
-  // Wait for request to finish.
+// Wait for a buf passed to idesubmit to finish.
+void
+ideiowait(struct buf *b)
+{
+  if(usevirtio && b->dev == 1){
+    virtiowait(b);
+    return;
+  }
+
+  acquire(&idelock);
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
+  release(&idelock);
+}
 
+// Sync bufs with disk, queueing them all before waiting.
+void
+iderwv(struct buf **bufs, int n)
+{
+  int i;
 
-  release(&idelock);
+  idesubmit(bufs, n);
+  for(i = 0; i < n; i++)
+    ideiowait(bufs[i]);
+}
+
+void
+iderw(struct buf *b)
+{
+  iderwv(&b, 1);
 }
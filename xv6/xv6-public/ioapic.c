@@ -64,6 +64,15 @@ ioapicinit(void)
   }
 }
 
+// Route irq to the given vector instead, level-triggered as
+// PCI interrupt lines are, and enable it.
+void
+ioapicroute(int irq, int vector, int cpunum)
+{
+  ioapicwrite(REG_TABLE+2*irq, INT_LEVEL | vector);
+  ioapicwrite(REG_TABLE+2*irq+1, cpunum << 24);
+}
+
 void
 ioapicenable(int irq, int cpunum)
 {
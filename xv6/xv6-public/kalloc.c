@@ -1,6 +1,7 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes, kernel stacks, page table pages,
-// and pipe buffers. Allocates 4096-byte pages.
+// pipe buffers, and the buffer cache, which gives pages back
+// when memory runs out. Allocates 4096-byte pages.
 
 #include "types.h"
 #include "defs.h"
@@ -21,6 +22,7 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  int nfree;
 } kmem;
 
 // Initialization happens in two phases.
@@ -72,25 +74,39 @@ kfree(char *v)
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   if(kmem.use_lock)
     release(&kmem.lock);
 }
 
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
-// Returns 0 if the memory cannot be allocated.
+// Returns 0 if the memory cannot be allocated,
+// even after taking pages back from the buffer cache.
 char*
 kalloc(void)
 {
   struct run *r;
 
-  if(kmem.use_lock)
-    acquire(&kmem.lock);
-  r = kmem.freelist;
-  if(r)
-    kmem.freelist = r->next;
-  if(kmem.use_lock)
-    release(&kmem.lock);
-  return (char*)r;
+  for(;;){
+    if(kmem.use_lock)
+      acquire(&kmem.lock);
+    r = kmem.freelist;
+    if(r){
+      kmem.freelist = r->next;
+      kmem.nfree--;
+    }
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    if(r || !kmem.use_lock || !bshrink())
+      return (char*)r;
+  }
+}
+
+// Number of free pages, without the lock; only a hint.
+int
+kfreepages(void)
+{
+  return kmem.nfree;
 }
 
@@ -60,13 +60,13 @@ lapicinit(void)
   // Enable local APIC; set spurious interrupt vector.
   lapicw(SVR, ENABLE | (T_IRQ0 + IRQ_SPURIOUS));
 
-  // The timer repeatedly counts down at bus frequency
-  // from lapic[TICR] and then issues an interrupt.
-  // If xv6 cared more about precise timekeeping,
-  // TICR would be calibrated using an external time source.
+  // The timer counts down once at bus frequency from
+  // lapic[TICR] and then issues an interrupt.  It stays
+  // idle until timerinit() calibrates it and lapictimer()
+  // arms it for the next deadline.
   lapicw(TDCR, X1);
-  lapicw(TIMER, PERIODIC | (T_IRQ0 + IRQ_TIMER));
-  lapicw(TICR, 10000000);
+  lapicw(TIMER, T_IRQ0 + IRQ_TIMER);
+  lapicw(TICR, 0);
 
   // Disable logical interrupt lines.
   lapicw(LINT0, MASKED);
@@ -113,6 +113,34 @@ lapiceoi(void)
     lapicw(EOI, 0);
 }
 
+// Send interrupt vector to the CPU with the given APIC ID.
+void
+lapicipi(int apicid, int vector)
+{
+  lapicw(ICRHI, apicid<<24);
+  lapicw(ICRLO, FIXED | vector);
+  while(lapic[ICRLO] & DELIVS)
+    ;
+}
+
+// Interrupt this CPU once after count timer ticks;
+// a count of 0 stops the timer.
+void
+lapictimer(uint count)
+{
+  if(lapic)
+    lapicw(TICR, count);
+}
+
+// Timer ticks left before the pending interrupt.
+uint
+lapictimercount(void)
+{
+  if(!lapic)
+    return 0;
+  return lapic[TCCR];
+}
+
 // Spin for a given number of microseconds.
 // On real hardware would want to tune this dynamically.
 void
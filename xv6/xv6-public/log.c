@@ -1,6 +1,8 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -15,19 +17,39 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end. begin_op() reserves MAXOPBLOCKS log
+// blocks for the call; begin_opn() reserves a number the
+// caller knows to be enough. Usually it just adds the
+// reservation and returns. But if the log could run out,
+// it sleeps until the log writer has made room.
+//
+// Commits are done by the logwriter kernel thread, not by
+// end_op(). Once a transaction has something in it, the thread
+// waits LOGWINDOW ticks so that more system calls can join,
+// then closes the transaction, waits for its outstanding calls
+// to end, and commits. end_op() therefore returns before the
+// changes are on disk; fsync() waits for them.
+//
+// A committed transaction is not installed right away. The next
+// transaction is appended after it, and commits rewrite the
+// header to cover both, so the log accumulates transactions
+// until it is half full or begin_op() needs the space. Then
+// each block is installed once, however many of the pending
+// transactions wrote it. Only the open transaction absorbs
+// repeated writes into one log block; a block written again
+// after it was committed gets a new log block, so that the
+// committed copy stays intact until the next commit point.
 //
 // The log is a physical re-do log containing disk blocks.
+// Its size is set by mkfs in the superblock.
 // The on-disk log format:
 //   header block, containing block #s for block A, B, C, ...
 //   block A
 //   block B
 //   block C
 //   ...
-// Log appends are synchronous.
+// A block # may appear more than once; the last copy wins.
+// Log appends are synchronous, but happen in the log writer.
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -39,16 +61,23 @@ struct logheader {
 struct log {
   struct spinlock lock;
   int start;
-  int size;
+  int size;        // data blocks, after the header block
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks promised to those calls.
+  int committing;  // transaction closed for commit, please wait.
+  int force;       // someone is waiting; commit without delay.
+  int full;        // begin_op() is out of space; install too.
+  int ncommit;     // header entries committed but not installed
+  uint seq;        // number of the open transaction
+  uint done;       // number of the last committed transaction
   int dev;
   struct logheader lh;
 };
 struct log log;
 
 static void recover_from_log(void);
-static void commit();
+static void commit(int);
+static void logwriter(void);
 
 void
 initlog(int dev)
@@ -60,25 +89,44 @@ initlog(int dev)
   initlock(&log.lock, "log");
   readsb(dev, &sb);
   log.start = sb.logstart;
-  log.size = sb.nlog;
+  log.size = sb.nlog - 1;
+  if(log.size > LOGSIZE)
+    panic("initlog: log too big");
+  if(log.size < MAXOPBLOCKS)
+    panic("initlog: log too small");
   log.dev = dev;
+  log.seq = 1;
   recover_from_log();
+  kthread("logwriter", logwriter);
 }
 
-// Copy committed blocks from log to their home location
+// Write committed blocks to their home locations: from the
+// log when recovering, otherwise from the cache, which holds
+// them pinned. A block is written once, from its last copy.
 static void
-install_trans(void)
+install_trans(int recovering)
 {
-  int tail;
+  int tail, i, n;
+  struct buf *dbuf[LOGSIZE];
 
+  n = 0;
   for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
-    brelse(lbuf);
-    brelse(dbuf);
+    for (i = tail+1; i < log.lh.n; i++)
+      if (log.lh.block[i] == log.lh.block[tail])
+        break;
+    if (i < log.lh.n)
+      continue;  // superseded by a later copy
+    dbuf[n] = bread(log.dev, log.lh.block[tail]); // read dst
+    if (recovering) {
+      struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
+      memmove(dbuf[n]->data, lbuf->data, BSIZE);  // copy block to dst
+      brelse(lbuf);
+    }
+    n++;
   }
+  bwritev(dbuf, n);  // write dsts to disk
+  for (i = 0; i < n; i++)
+    brelse(dbuf[i]);
 }
 
 // Read the log header from disk into the in-memory log header
@@ -116,7 +164,7 @@ static void
 recover_from_log(void)
 {
   read_head();
-  install_trans(); // if committed, copy from log to disk
+  install_trans(1); // if committed, copy from log to disk
   log.lh.n = 0;
   write_head(); // clear the log
 }
@@ -124,16 +172,27 @@ recover_from_log(void)
 // called at the start of each FS system call.
 void
 begin_op(void)
+{
+  begin_opn(MAXOPBLOCKS);
+}
+
+// Start an FS system call that writes at most n blocks.
+void
+begin_opn(int n)
 {
   acquire(&log.lock);
   while(1){
     if(log.committing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.size){
       // this op might exhaust log space; wait for commit.
+      log.full = 1;
+      wakeup(&log);
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      myproc()->logres = n;
       release(&log.lock);
       break;
     }
@@ -141,63 +200,128 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
+// The log writer commits once no operations are outstanding.
 void
 end_op(void)
 {
-  int do_commit = 0;
-
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
+  log.reserved -= myproc()->logres;
+  myproc()->logres = 0;
+  // The log writer may be waiting for this op to end, and
+  // begin_op() may be waiting for log space, which
+  // decrementing log.reserved has freed up.
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// The most blocks a single operation should reserve, so that
+// large writes can be split into transactions that fit.
+int
+log_maxop(void)
+{
+  return log.size/2 > MAXOPBLOCKS ? log.size/2 : MAXOPBLOCKS;
+}
+
+// Wait until every operation that has ended so far is
+// committed to disk.
+void
+log_force(void)
+{
+  uint want;
+
+  acquire(&log.lock);
+  want = (log.lh.n > log.ncommit && !log.committing) ? log.seq : log.seq - 1;
+  if(log.done < want){
+    log.force = 1;
     wakeup(&log);
   }
+  while(log.done < want)
+    sleep(&log, &log.lock);
   release(&log.lock);
+}
+
+// Kernel thread that commits transactions, batching the
+// system calls that end within LOGWINDOW ticks of each other.
+static void
+logwriter(void)
+{
+  uint t0;
+  int install;
+
+  for(;;){
+    acquire(&log.lock);
+    while(log.lh.n == log.ncommit && !log.full)
+      sleep(&log, &log.lock);
+    release(&log.lock);
+
+    // Unless fsync() or begin_op() is waiting, let more
+    // system calls join this transaction.
+    acquire(&tickslock);
+    t0 = ticks;
+    while(ticks - t0 < LOGWINDOW && !log.force && !log.full)
+      sleep(&ticks, &tickslock);
+    release(&tickslock);
+
+    // Close the transaction and wait for the system calls
+    // still in it to end.
+    acquire(&log.lock);
+    log.committing = 1;
+    log.force = 0;
+    log.seq++;
+    while(log.outstanding > 0)
+      sleep(&log, &log.lock);
+    install = log.full || log.lh.n > log.size/2;
+    log.full = 0;
+    release(&log.lock);
 
-  if(do_commit){
     // call commit w/o holding locks, since not allowed
     // to sleep with locks.
-    commit();
+    commit(install);
+
     acquire(&log.lock);
     log.committing = 0;
+    log.done = log.seq - 1;
     wakeup(&log);
     release(&log.lock);
   }
 }
 
-// Copy modified blocks from cache to log.
+// Copy the open transaction's blocks from cache to log.
 static void
 write_log(void)
 {
-  int tail;
+  int tail, n;
+  struct buf *to[LOGSIZE];
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
+  n = 0;
+  for (tail = log.ncommit; tail < log.lh.n; tail++) {
+    to[n] = bread(log.dev, log.start+tail+1); // log block
     struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
+    memmove(to[n]->data, from->data, BSIZE);
     brelse(from);
-    brelse(to);
+    n++;
   }
+  bwritev(to, n);  // write the log
+  for (tail = 0; tail < n; tail++)
+    brelse(to[tail]);
 }
 
+// Commit the open transaction after those already in the log,
+// and if install is set, install them all and empty the log.
 static void
-commit()
+commit(int install)
 {
-  if (log.lh.n > 0) {
+  if (log.lh.n > log.ncommit) {
     write_log();     // Write modified blocks from cache to log
     write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
+    log.ncommit = log.lh.n;
+  }
+  if (install && log.ncommit > 0) {
+    install_trans(0); // Now install writes to home locations
     log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+    log.ncommit = 0;
+    write_head();    // Erase the transactions from the log
   }
 }
 
@@ -215,19 +339,20 @@ log_write(struct buf *b)
 {
   int i;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
-    panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
+  for (i = log.ncommit; i < log.lh.n; i++) {
     if (log.lh.block[i] == b->blockno)   // log absorbtion
       break;
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
+  if (i == log.lh.n) {
+    if (log.lh.n >= log.size)
+      panic("too big a transaction");
+    log.lh.block[i] = b->blockno;
     log.lh.n++;
+  }
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
 }
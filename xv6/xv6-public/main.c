@@ -21,6 +21,7 @@ main(void)
   kvmalloc();      // kernel page table
   mpinit();        // detect other processors
   lapicinit();     // interrupt controller
+  timerinit();     // calibrate and start the LAPIC timer
   seginit();       // segment descriptors
   picinit();       // disable pic
   ioapicinit();    // another interrupt controller
@@ -28,11 +29,12 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
-  binit();         // buffer cache
   fileinit();      // file table
+  pollinit();      // poll() wait queues
   ideinit();       // disk 
   startothers();   // start other processors
   kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  binit();         // buffer cache, sized from free memory
   userinit();      // first user process
   mpmain();        // finish this processor's setup
 }
@@ -44,6 +46,7 @@ mpenter(void)
   switchkvm();
   seginit();
   lapicinit();
+  timerinit();
   mpmain();
 }
 
@@ -22,7 +22,7 @@
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = LOGSIZE+1;  // header block and data blocks
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -40,6 +40,7 @@ void rinode(uint inum, struct dinode *ip);
 void rsect(uint sec, void *buf);
 uint ialloc(ushort type);
 void iappend(uint inum, void *p, int n);
+void dirappend(uint dino, struct dirent *de);
 
 // convert to intel byte order
 ushort
@@ -75,9 +76,21 @@ main(int argc, char *argv[])
 
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
+  static_assert(BSIZE % 512 == 0 && BSIZE <= 4096, "BSIZE must be 512 to 4096");
+
+  if(argc > 3 && strcmp(argv[1], "-l") == 0){
+    nlog = atoi(argv[2]);
+    if(nlog < MAXOPBLOCKS+1 || nlog > LOGSIZE+1){
+      fprintf(stderr, "mkfs: log size must be %d to %d blocks\n",
+              MAXOPBLOCKS+1, LOGSIZE+1);
+      exit(1);
+    }
+    argc -= 2;
+    argv += 2;
+  }
 
   if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+    fprintf(stderr, "Usage: mkfs [-l nlog] fs.img files...\n");
     exit(1);
   }
 
@@ -98,6 +111,7 @@ main(int argc, char *argv[])
   sb.nblocks = xint(nblocks);
   sb.ninodes = xint(NINODES);
   sb.nlog = xint(nlog);
+  sb.bsize = xint(BSIZE);
   sb.logstart = xint(2);
   sb.inodestart = xint(2+nlog);
   sb.bmapstart = xint(2+nlog+ninodeblocks);
@@ -116,6 +130,9 @@ main(int argc, char *argv[])
 
   rootino = ialloc(T_DIR);
   assert(rootino == ROOTINO);
+  rinode(rootino, &din);
+  din.major = xshort(DIRHASH);
+  winode(rootino, &din);
 
   bzero(&de, sizeof(de));
   de.inum = xshort(rootino);
@@ -147,7 +164,7 @@ main(int argc, char *argv[])
     bzero(&de, sizeof(de));
     de.inum = xshort(inum);
     strncpy(de.name, argv[i], DIRSIZ);
-    iappend(rootino, &de, sizeof(de));
+    dirappend(rootino, &de);
 
     while((cc = read(fd, buf, sizeof(buf))) > 0)
       iappend(inum, buf, cc);
@@ -155,12 +172,16 @@ main(int argc, char *argv[])
     close(fd);
   }
 
-  // fix size of root inode dir
+  // fix size of root inode dir, unless it is hashed.  A root
+  // that exactly fills the linear blocks has no map yet, so
+  // leave it for dirhslot() to add on the next insert.
   rinode(rootino, &din);
   off = xint(din.size);
-  off = ((off/BSIZE) + 1) * BSIZE;
-  din.size = xint(off);
-  winode(rootino, &din);
+  if(off < DIRLINEAR*BSIZE){
+    off = (off + BSIZE - 1) / BSIZE * BSIZE;
+    din.size = xint(off);
+    winode(rootino, &din);
+  }
 
   balloc(freeblock);
 
@@ -252,6 +273,51 @@ balloc(int used)
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+// Disk block holding block fbn of the file, allocating
+// it (and indirect blocks) if need be.
+uint
+ibmap(struct dinode *din, uint fbn)
+{
+  uint indirect[NINDIRECT];
+  uint x, idx, ind;
+
+  assert(fbn < MAXFILE);
+  if(fbn < NDIRECT){
+    if(xint(din->addrs[fbn]) == 0){
+      din->addrs[fbn] = xint(freeblock++);
+    }
+    x = xint(din->addrs[fbn]);
+  } else if(fbn < NDIRECT + NINDIRECT){
+    if(xint(din->addrs[NDIRECT]) == 0){
+      din->addrs[NDIRECT] = xint(freeblock++);
+    }
+    rsect(xint(din->addrs[NDIRECT]), (char*)indirect);
+    if(indirect[fbn - NDIRECT] == 0){
+      indirect[fbn - NDIRECT] = xint(freeblock++);
+      wsect(xint(din->addrs[NDIRECT]), (char*)indirect);
+    }
+    x = xint(indirect[fbn-NDIRECT]);
+  } else {
+    idx = fbn - NDIRECT - NINDIRECT;
+    if(xint(din->addrs[NDIRECT+1]) == 0){
+      din->addrs[NDIRECT+1] = xint(freeblock++);
+    }
+    rsect(xint(din->addrs[NDIRECT+1]), (char*)indirect);
+    if(indirect[idx / NINDIRECT] == 0){
+      indirect[idx / NINDIRECT] = xint(freeblock++);
+      wsect(xint(din->addrs[NDIRECT+1]), (char*)indirect);
+    }
+    ind = xint(indirect[idx / NINDIRECT]);
+    rsect(ind, (char*)indirect);
+    if(indirect[idx % NINDIRECT] == 0){
+      indirect[idx % NINDIRECT] = xint(freeblock++);
+      wsect(ind, (char*)indirect);
+    }
+    x = xint(indirect[idx % NINDIRECT]);
+  }
+  return x;
+}
+
 void
 iappend(uint inum, void *xp, int n)
 {
@@ -259,7 +325,6 @@ iappend(uint inum, void *xp, int n)
   uint fbn, off, n1;
   struct dinode din;
   char buf[BSIZE];
-  uint indirect[NINDIRECT];
   uint x;
 
   rinode(inum, &din);
@@ -267,23 +332,7 @@ iappend(uint inum, void *xp, int n)
   // printf("append inum %d at off %d sz %d\n", inum, off, n);
   while(n > 0){
     fbn = off / BSIZE;
-    assert(fbn < MAXFILE);
-    if(fbn < NDIRECT){
-      if(xint(din.addrs[fbn]) == 0){
-        din.addrs[fbn] = xint(freeblock++);
-      }
-      x = xint(din.addrs[fbn]);
-    } else {
-      if(xint(din.addrs[NDIRECT]) == 0){
-        din.addrs[NDIRECT] = xint(freeblock++);
-      }
-      rsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      if(indirect[fbn - NDIRECT] == 0){
-        indirect[fbn - NDIRECT] = xint(freeblock++);
-        wsect(xint(din.addrs[NDIRECT]), (char*)indirect);
-      }
-      x = xint(indirect[fbn-NDIRECT]);
-    }
+    x = ibmap(&din, fbn);
     n1 = min(n, (fbn + 1) * BSIZE - off);
     rsect(x, buf);
     bcopy(p, buf + off - (fbn * BSIZE), n1);
@@ -295,3 +344,76 @@ iappend(uint inum, void *xp, int n)
   din.size = xint(off);
   winode(inum, &din);
 }
+
+// Read or write the dirent-sized record at off in directory dino.
+void
+dirrw(uint dino, void *p, uint off, int write)
+{
+  struct dinode din;
+  char buf[BSIZE];
+  uint x;
+
+  rinode(dino, &din);
+  x = ibmap(&din, off / BSIZE);
+  rsect(x, buf);
+  if(write){
+    bcopy(p, buf + off % BSIZE, sizeof(struct dirent));
+    wsect(x, buf);
+  } else
+    bcopy(buf + off % BSIZE, p, sizeof(struct dirent));
+}
+
+// Same hash as the kernel's.
+uint
+dirhash(char *name)
+{
+  uint h;
+  int i;
+
+  h = 0;
+  for(i = 0; i < DIRSIZ && name[i]; i++)
+    h = h*31 + name[i];
+  return h % NDIRBUCKET;
+}
+
+// Add de to directory dino, in its bucket if dino is hashed.
+void
+dirappend(uint dino, struct dirent *de)
+{
+  struct dinode din;
+  struct dirmap m;
+  struct dirent e;
+  uint b, fbn, off, moff, slot;
+
+  rinode(dino, &din);
+  if(xshort(din.major) != DIRHASH || xint(din.size) < DIRLINEAR*BSIZE){
+    iappend(dino, de, sizeof(*de));
+    return;
+  }
+  if(xint(din.size) == DIRLINEAR*BSIZE)
+    iappend(dino, zeroes, BSIZE);  // the map
+
+  b = dirhash(de->name);
+  moff = DIRLINEAR*BSIZE + b/3*sizeof(m);
+  slot = b%3;
+  dirrw(dino, &m, moff, 0);
+  while((fbn = xint(m.fbn[slot])) != 0){
+    for(off = fbn*BSIZE + sizeof(e); off < (fbn+1)*BSIZE; off += sizeof(e)){
+      dirrw(dino, &e, off, 0);
+      if(e.inum == 0){
+        dirrw(dino, de, off, 1);
+        return;
+      }
+    }
+    moff = fbn*BSIZE;
+    slot = 0;
+    dirrw(dino, &m, moff, 0);
+  }
+
+  rinode(dino, &din);
+  fbn = xint(din.size) / BSIZE;
+  iappend(dino, zeroes, BSIZE);
+  m.fbn[slot] = xint(fbn);
+  dirrw(dino, &m, moff, 1);
+  dirrw(dino, de, fbn*BSIZE + sizeof(e), 1);
+}
@@ -3,12 +3,18 @@
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
 #define NFILE       100  // open files per system
-#define NINODE       50  // maximum number of active i-nodes
+#define NINODE       50  // minimum size of the i-node cache
+#define ICACHEPCT     1  // percent of free memory for the i-node cache
+#define NDENTRY     256  // entries in the directory name cache
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
-#define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
-#define FSSIZE       1000  // size of file system in blocks
+#define MAXOPBLOCKS  10  // log blocks begin_op() reserves for an FS op
+#define LOGSIZE     126  // max data blocks in on-disk log (header fits a block)
+#define LOGWINDOW    2   // ticks the log writer waits to batch commits
+#define NBUF         (LOGSIZE*3)  // minimum size of disk block cache
+#define BCACHEPCT    10  // percent of free memory for disk block cache
+#define FSSIZE       2000  // size of file system in blocks
+#define TICKUS      10000  // microseconds per scheduler tick
+#define TICKLESS        1  // idle CPUs other than cpu0 stop their tick
 
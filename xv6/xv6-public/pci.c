@@ -0,0 +1,75 @@
+// Minimal PCI bus enumeration for drivers that need to find
+// their device and its I/O ports.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_ADDR  0xCF8
+#define PCI_DATA  0xCFC
+
+static uint
+pciaddr(struct pcidev *d, int off)
+{
+  return 0x80000000 | (d->bus << 16) | (d->dev << 11) | (d->func << 8) | (off & 0xFC);
+}
+
+uint
+pciread(struct pcidev *d, int off)
+{
+  outl(PCI_ADDR, pciaddr(d, off));
+  return inl(PCI_DATA);
+}
+
+void
+pciwrite(struct pcidev *d, int off, uint v)
+{
+  outl(PCI_ADDR, pciaddr(d, off));
+  outl(PCI_DATA, v);
+}
+
+// Find the first function whose vendor and device ids, and
+// class and subclass, match; PCI_ANY matches anything.
+// Fills in *d and returns 0, or returns -1.
+int
+pcifind(int vendor, int device, int class, int subclass, struct pcidev *d)
+{
+  uint id, cl;
+  int i, nfunc;
+
+  for(d->bus = 0; d->bus < 256; d->bus++){
+    for(d->dev = 0; d->dev < 32; d->dev++){
+      nfunc = 1;
+      for(d->func = 0; d->func < nfunc; d->func++){
+        id = pciread(d, PCI_ID);
+        if((id & 0xFFFF) == 0xFFFF)
+          continue;
+        if(d->func == 0 && (pciread(d, PCI_HDR) & PCI_HDR_MULTI))
+          nfunc = 8;
+        cl = pciread(d, PCI_CLASS);
+        d->vendor = id & 0xFFFF;
+        d->device = id >> 16;
+        d->class = cl >> 24;
+        d->subclass = (cl >> 16) & 0xFF;
+        if((vendor != PCI_ANY && d->vendor != vendor) ||
+           (device != PCI_ANY && d->device != device) ||
+           (class != PCI_ANY && d->class != class) ||
+           (subclass != PCI_ANY && d->subclass != subclass))
+          continue;
+        for(i = 0; i < 6; i++)
+          d->bar[i] = pciread(d, PCI_BAR0 + 4*i);
+        d->irq = pciread(d, PCI_INTR) & 0xFF;
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+// Let d decode its I/O and memory BARs and master the bus.
+void
+pcienable(struct pcidev *d)
+{
+  pciwrite(d, PCI_CMD, pciread(d, PCI_CMD) | PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
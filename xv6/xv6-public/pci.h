@@ -0,0 +1,32 @@
+// PCI configuration space, reached through
+// configuration mechanism #1 (ports 0xCF8/0xCFC).
+
+#define PCI_ANY      0xFFFF   // pcifind() wildcard
+
+// Configuration space registers.
+#define PCI_ID       0x00     // device << 16 | vendor
+#define PCI_CMD      0x04     // command (low 16 bits)
+  #define PCI_CMD_IO     0x0001   // respond to I/O space accesses
+  #define PCI_CMD_MEM    0x0002   // respond to memory space accesses
+  #define PCI_CMD_MASTER 0x0004   // may act as a bus master (DMA)
+#define PCI_CLASS    0x08     // class << 24 | subclass << 16 | ...
+#define PCI_HDR      0x0C     // header type in bits 16-23
+  #define PCI_HDR_MULTI  0x00800000   // device has functions 1-7
+#define PCI_BAR0     0x10     // base address registers 0-5
+#define PCI_INTR     0x3C     // interrupt line (low 8 bits)
+
+// Classes and subclasses.
+#define PCI_STORAGE      0x01
+  #define PCI_STORAGE_IDE  0x01
+
+struct pcidev {
+  int bus;
+  int dev;
+  int func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uint bar[6];
+  int irq;
+};
@@ -7,18 +7,55 @@
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
+#include "fcntl.h"
+#include "poll.h"
+#include "uio.h"
 
-#define PIPESIZE 512
+// The buffer is a power-of-two number of kalloc() pages,
+// so nread and nwrite can run on past 2^32 and still index
+// it.  Copies go a page piece at a time with memmove.
+#define PIPEMAXPG 16
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
 
 struct pipe {
   struct spinlock lock;
-  char data[PIPESIZE];
+  char *pg[PIPEMAXPG];
+  uint size;      // bytes in the buffer, npg*PGSIZE
   uint nread;     // number of bytes read
   uint nwrite;    // number of bytes written
+  uint rlowat;    // wake readers once this much is buffered
+  uint wlowat;    // wake writers once this much room is free
+  uint wneed;     // ... or this much, if a writer needs less
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
+  struct waitq rpollq; // procs in poll() on the read end
+  struct waitq wpollq; // procs in poll() on the write end
 };
 
+#define PIPEROOM(p) ((p)->size - ((p)->nwrite - (p)->nread))
+#define PIPEDATA(p) ((p)->nwrite - (p)->nread)
+
+// Wake the procs sleeping on chan, and those polling the
+// end of p that sleeps there: readers on nread, writers on
+// nwrite.
+static void
+pipewakeup(struct pipe *p, void *chan)
+{
+  wakeup(chan);
+  pollwakeup(chan == &p->nread ? &p->rpollq : &p->wpollq);
+}
+
+static void
+pipefree(struct pipe *p)
+{
+  int i;
+
+  for(i = 0; i < PIPEMAXPG && p->pg[i]; i++)
+    kfree(p->pg[i]);
+  kfree((char*)p);
+}
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -30,6 +67,12 @@ pipealloc(struct file **f0, struct file **f1)
     goto bad;
   if((p = (struct pipe*)kalloc()) == 0)
     goto bad;
+  memset(p, 0, sizeof(*p));
+  if((p->pg[0] = kalloc()) == 0)
+    goto bad;
+  p->size = PGSIZE;
+  p->rlowat = 1;
+  p->wlowat = p->wneed = 1;
   p->readopen = 1;
   p->writeopen = 1;
   p->nwrite = 0;
@@ -48,7 +91,7 @@ pipealloc(struct file **f0, struct file **f1)
 //PAGEBREAK: 20
  bad:
   if(p)
-    kfree((char*)p);
+    pipefree(p);
   if(*f0)
     fileclose(*f0);
   if(*f1)
@@ -62,60 +105,368 @@ pipeclose(struct pipe *p, int writable)
   acquire(&p->lock);
   if(writable){
     p->writeopen = 0;
-    wakeup(&p->nread);
+    pipewakeup(p, &p->nread);
   } else {
     p->readopen = 0;
-    wakeup(&p->nwrite);
+    pipewakeup(p, &p->nwrite);
   }
   if(p->readopen == 0 && p->writeopen == 0){
     release(&p->lock);
-    kfree((char*)p);
+    pipefree(p);
   } else
     release(&p->lock);
 }
 
+// Copy n bytes from addr into p, which has room.
+static void
+pipein(struct pipe *p, char *addr, uint n)
+{
+  uint off, m;
+
+  for(; n > 0; n -= m, addr += m){
+    off = p->nwrite % p->size;
+    m = min(n, PGSIZE - off%PGSIZE);
+    memmove(p->pg[off/PGSIZE] + off%PGSIZE, addr, m);
+    p->nwrite += m;
+  }
+}
+
+// Copy n buffered bytes out of p to addr.
+static void
+pipeout(struct pipe *p, char *addr, uint n)
+{
+  uint off, m;
+
+  for(; n > 0; n -= m, addr += m){
+    off = p->nread % p->size;
+    m = min(n, PGSIZE - off%PGSIZE);
+    memmove(addr, p->pg[off/PGSIZE] + off%PGSIZE, m);
+    p->nread += m;
+  }
+}
+
+// Sleep until p has want bytes of room, noting that this
+// writer can go on with need bytes.  Caller holds p->lock.
+static int
+pipesleepw(struct pipe *p, uint want, uint need)
+{
+  while(PIPEROOM(p) < want){  //DOC: pipewrite-full
+    if(p->readopen == 0 || myproc()->killed)
+      return -1;
+    if(need < p->wneed)
+      p->wneed = need;
+    pipewakeup(p, &p->nread);
+    sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+  }
+  return 0;
+}
+
 //PAGEBREAK: 40
+// Write all of the cnt buffers in iov, holding p->lock
+// throughout except while waiting for room.
 int
-pipewrite(struct pipe *p, char *addr, int n)
+pipewritev(struct pipe *p, struct iovec *iov, int cnt)
 {
-  int i;
+  int j, n;
+  uint i, m;
+  char *addr;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->nwrite == p->nread + PIPESIZE){  //DOC: pipewrite-full
-      if(p->readopen == 0 || myproc()->killed){
+  n = 0;
+  for(j = 0; j < cnt; j++){
+    addr = iov[j].iov_base;
+    for(i = 0; i < iov[j].iov_len; i += m){
+      if(pipesleepw(p, 1, iov[j].iov_len - i) < 0){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->nread);
-      sleep(&p->nwrite, &p->lock);  //DOC: pipewrite-sleep
+      m = min(iov[j].iov_len - i, PIPEROOM(p));
+      pipein(p, addr + i, m);
     }
-    p->data[p->nwrite++ % PIPESIZE] = addr[i];
+    n += iov[j].iov_len;
   }
-  wakeup(&p->nread);  //DOC: pipewrite-wakeup1
+  if(PIPEDATA(p) >= p->rlowat)
+    pipewakeup(p, &p->nread);  //DOC: pipewrite-wakeup1
   release(&p->lock);
   return n;
 }
 
 int
-piperead(struct pipe *p, char *addr, int n)
+pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  struct iovec iov;
+
+  iov.iov_base = addr;
+  iov.iov_len = n;
+  return pipewritev(p, &iov, 1);
+}
+
+// Copy as much of addr[0..n) into p as there is room for,
+// without waiting.  Returns the number of bytes copied, or
+// -1 if p has no reader.
+int
+pipeput(struct pipe *p, char *addr, int n)
+{
+  uint m;
+
+  acquire(&p->lock);
+  if(p->readopen == 0){
+    release(&p->lock);
+    return -1;
+  }
+  m = min(n, PIPEROOM(p));
+  pipein(p, addr, m);
+  if(PIPEDATA(p) >= p->rlowat)
+    pipewakeup(p, &p->nread);
+  release(&p->lock);
+  return m;
+}
+
+// Wait until p has room for at least one byte.
+int
+pipewaitroom(struct pipe *p)
+{
+  int r;
 
   acquire(&p->lock);
-  while(p->nread == p->nwrite && p->writeopen){  //DOC: pipe-empty
+  r = pipesleepw(p, 1, 1);
+  release(&p->lock);
+  return r;
+}
+
+// Wait for data, then fill the cnt buffers in iov
+// with as much as there is.
+int
+pipereadv(struct pipe *p, struct iovec *iov, int cnt)
+{
+  int j, n;
+  uint m;
+
+  acquire(&p->lock);
+  while(PIPEDATA(p) < p->rlowat && p->writeopen){  //DOC: pipe-empty
     if(myproc()->killed){
       release(&p->lock);
       return -1;
     }
     sleep(&p->nread, &p->lock); //DOC: piperead-sleep
   }
-  for(i = 0; i < n; i++){  //DOC: piperead-copy
-    if(p->nread == p->nwrite)
+  n = 0;
+  for(j = 0; j < cnt && PIPEDATA(p) > 0; j++){  //DOC: piperead-copy
+    m = min(iov[j].iov_len, PIPEDATA(p));
+    pipeout(p, iov[j].iov_base, m);
+    n += m;
+  }
+  if(PIPEROOM(p) >= p->wneed){
+    p->wneed = p->wlowat;
+    pipewakeup(p, &p->nwrite);  //DOC: piperead-wakeup
+  }
+  release(&p->lock);
+  return n;
+}
+
+int
+piperead(struct pipe *p, char *addr, int n)
+{
+  struct iovec iov;
+
+  iov.iov_base = addr;
+  iov.iov_len = n;
+  return pipereadv(p, &iov, 1);
+}
+
+// Give the pages at [va, va+n) in the caller's wmap region
+// r to p.  Where p's next free byte starts a page, the page
+// itself takes that slot in the ring; elsewhere it is copied
+// in.  Either way the range reads as zeros afterwards.
+int
+pipegift(struct pipe *p, struct lazy *r, uint va, int n)
+{
+  char *pg;
+  uint slot;
+  int off;
+
+  acquire(&p->lock);
+  for(off = 0; off < n; off += PGSIZE){
+    if(pipesleepw(p, PGSIZE, PGSIZE) < 0)
+      break;
+    if((pg = wmapswap(r, va + off, 0)) == 0){
+      if((pg = kalloc()) == 0)
+        break;
+      memset(pg, 0, PGSIZE);
+    }
+    if(p->nwrite % PGSIZE == 0){
+      slot = (p->nwrite % p->size) / PGSIZE;
+      kfree(p->pg[slot]);
+      p->pg[slot] = pg;
+      p->nwrite += PGSIZE;
+    } else {
+      pipein(p, pg, PGSIZE);
+      kfree(pg);
+    }
+  }
+  if(PIPEDATA(p) >= p->rlowat)
+    pipewakeup(p, &p->nread);
+  release(&p->lock);
+  return off > 0 ? off : -1;
+}
+
+// Read up to n bytes from p into [va, va+n) in the caller's
+// wmap region r.  Whole buffered pages that start a page of
+// the ring are swapped with the caller's pages rather than
+// copied.  Waits only for the first page.
+int
+pipetake(struct pipe *p, struct lazy *r, uint va, int n)
+{
+  char *pg;
+  uint slot, m;
+  int off;
+
+  acquire(&p->lock);
+  for(off = 0; off < n; off += m){
+    while(PIPEDATA(p) < PGSIZE && p->writeopen && off == 0){
+      if(myproc()->killed){
+        release(&p->lock);
+        return -1;
+      }
+      sleep(&p->nread, &p->lock);
+    }
+    m = min(PIPEDATA(p), PGSIZE);
+    if(m == 0 || (m < PGSIZE && p->writeopen))
+      break;
+    if((pg = wmappage(r, va + off)) == 0)
       break;
-    addr[i] = p->data[p->nread++ % PIPESIZE];
+    if(m == PGSIZE && p->nread % PGSIZE == 0){
+      slot = (p->nread % p->size) / PGSIZE;
+      p->pg[slot] = wmapswap(r, va + off, p->pg[slot]);
+      p->nread += PGSIZE;
+    } else
+      pipeout(p, pg, m);
+  }
+  if(PIPEROOM(p) >= p->wneed){
+    p->wneed = p->wlowat;
+    pipewakeup(p, &p->nwrite);
   }
-  wakeup(&p->nwrite);  //DOC: piperead-wakeup
   release(&p->lock);
-  return i;
+  return off;
+}
+
+// Report which of events are ready on the read end of p,
+// or the write end if writable.  If none are, link pe, if
+// given, on that end's waitq.
+int
+pipepoll(struct pipe *p, int writable, int events, struct pollent *pe)
+{
+  int r;
+
+  acquire(&p->lock);
+  r = 0;
+  if(writable){
+    if(p->readopen == 0)
+      r |= POLLERR;
+    else if(PIPEROOM(p) >= p->wlowat)
+      r |= events & POLLOUT;
+  } else {
+    if(PIPEDATA(p) >= p->rlowat)
+      r |= events & POLLIN;
+    if(p->writeopen == 0)
+      r |= POLLHUP;
+  }
+  if(r == 0 && pe)
+    pollwait(writable ? &p->wpollq : &p->rpollq, &p->lock, pe);
+  release(&p->lock);
+  return r;
+}
+
+// Move p's contents into the npg pages in pg and free the
+// old buffer.  Caller holds p->lock.
+static void
+piperesize(struct pipe *p, char **pg, int npg)
+{
+  char *old[PIPEMAXPG];
+  uint n, m, off;
+  int i;
+
+  n = PIPEDATA(p);
+  for(off = 0; off < n; off += m){
+    m = min(n - off, PGSIZE);
+    pipeout(p, pg[off/PGSIZE], m);
+  }
+  memmove(old, p->pg, sizeof(old));
+  memset(p->pg, 0, sizeof(p->pg));
+  for(i = 0; i < npg; i++)
+    p->pg[i] = pg[i];
+  p->size = npg*PGSIZE;
+  p->nread = 0;
+  p->nwrite = n;
+  memmove(pg, old, sizeof(old));
+}
+
+// fcntl() on a pipe: read or change its size and
+// its wakeup thresholds.
+int
+pipefcntl(struct pipe *p, int cmd, int arg)
+{
+  char *pg[PIPEMAXPG];
+  int i, npg, r;
+
+  switch(cmd){
+  case F_GETPIPE_SZ:
+    return p->size;
+
+  case F_SETPIPE_SZ:
+    // Round up to a power of two pages.
+    for(npg = 1; npg < PIPEMAXPG && npg*PGSIZE < arg; npg *= 2)
+      ;
+    if(arg < 0 || npg*PGSIZE < arg)
+      return -1;
+    r = -1;
+    memset(pg, 0, sizeof(pg));
+    for(i = 0; i < npg; i++){
+      if((pg[i] = kalloc()) == 0)
+        goto out;
+    }
+    acquire(&p->lock);
+    if(PIPEDATA(p) <= npg*PGSIZE){
+      piperesize(p, pg, npg);
+      // Keep the thresholds within the new size together,
+      // as F_SETRLOWAT and F_SETWLOWAT do.
+      if(p->rlowat + p->wlowat > p->size){
+        if(p->rlowat > p->size/2)
+          p->rlowat = p->size/2;
+        if(p->wlowat > p->size/2)
+          p->wlowat = p->size/2;
+      }
+      p->wneed = p->wlowat;
+      pipewakeup(p, &p->nwrite);
+      r = p->size;
+    }
+    release(&p->lock);
+  out:
+    // pg now holds whichever pages went unused.
+    for(i = 0; i < PIPEMAXPG && pg[i]; i++)
+      kfree(pg[i]);
+    return r;
+
+  case F_SETRLOWAT:
+  case F_SETWLOWAT:
+    // A reader waiting for rlowat bytes and a writer waiting
+    // for wlowat bytes of room would wait on each other for
+    // good if both could not hold at once.
+    acquire(&p->lock);
+    if(arg < 1 ||
+       arg + (cmd == F_SETRLOWAT ? p->wlowat : p->rlowat) > p->size){
+      release(&p->lock);
+      return -1;
+    }
+    if(cmd == F_SETRLOWAT){
+      p->rlowat = arg;
+      pipewakeup(p, &p->nread);
+    } else {
+      p->wlowat = p->wneed = arg;
+      pipewakeup(p, &p->nwrite);
+    }
+    release(&p->lock);
+    return 0;
+  }
+  return -1;
 }
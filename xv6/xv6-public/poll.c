@@ -0,0 +1,98 @@
+// Waiting on several files at once, for poll().
+//
+// A file that poll() can wait on keeps a waitq, protected by
+// the file's own lock.  poll() links a pollent for each of its
+// files onto their waitqs and sleeps on its proc.  When a file
+// changes, pollwakeup() wakes just the procs linked on its
+// waitq.  p->pollev, protected by polllock, records that a
+// wakeup came while the proc was still checking its files.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+
+static struct spinlock polllock;
+
+void
+pollinit(void)
+{
+  initlock(&polllock, "poll");
+}
+
+// Forget wakeups from before this round of checks.
+void
+pollstart(void)
+{
+  acquire(&polllock);
+  myproc()->pollev = 0;
+  release(&polllock);
+}
+
+// Link pe onto q, which lk protects.  Caller holds lk.
+void
+pollwait(struct waitq *q, struct spinlock *lk, struct pollent *pe)
+{
+  pe->p = myproc();
+  pe->q = q;
+  pe->lk = lk;
+  pe->next = q->head;
+  q->head = pe;
+}
+
+// Unlink pe from its waitq, if pollwait() linked it.
+void
+polldone(struct pollent *pe)
+{
+  struct pollent **pp;
+
+  if(pe->q == 0)
+    return;
+  acquire(pe->lk);
+  for(pp = &pe->q->head; *pp; pp = &(*pp)->next){
+    if(*pp == pe){
+      *pp = pe->next;
+      break;
+    }
+  }
+  release(pe->lk);
+  pe->q = 0;
+}
+
+// Wake the procs polling q.  Caller holds q's lock.
+void
+pollwakeup(struct waitq *q)
+{
+  struct pollent *pe;
+
+  if(q->head == 0)
+    return;
+  acquire(&polllock);
+  for(pe = q->head; pe; pe = pe->next){
+    pe->p->pollev = 1;
+    wakeup(&pe->p->deadline);
+  }
+  release(&polllock);
+}
+
+// Sleep until pollwakeup() or, unless it is 0, until
+// microtime() reaches deadline.
+void
+pollsleep(uint64 deadline)
+{
+  struct proc *p = myproc();
+
+  acquire(&polllock);
+  if(!p->pollev && !p->killed){
+    if(deadline)
+      timedsleep(deadline, &polllock);
+    else
+      sleep(&p->deadline, &polllock);
+  }
+  release(&polllock);
+}
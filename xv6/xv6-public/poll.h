@@ -0,0 +1,17 @@
+#ifndef POLL_H
+#define POLL_H
+
+// for `poll`
+#define POLLIN   0x001		  // data to read
+#define POLLOUT  0x004		  // room to write
+#define POLLERR  0x008		  // the read end of a pipe is closed
+#define POLLHUP  0x010		  // the write end of a pipe is closed
+#define POLLNVAL 0x020		  // fd is not open
+
+struct pollfd {
+	int fd;
+	short events;			  // What to wait for
+	short revents;			  // What happened
+};
+
+#endif /* POLL_H */
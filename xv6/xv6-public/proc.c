@@ -6,24 +6,41 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "traps.h"
+#include "pstat.h"
 
 struct
 {
   struct spinlock lock;
   struct proc proc[NPROC];
+  struct group group[NPROC];
 } ptable;
 
 static struct proc *initproc;
 
+// Serializes growproc() so threads sharing a page table
+// cannot grow it concurrently.
+static struct spinlock growlock;
+
+// Protects the check-and-sleep in futexwait() against futexwake().
+static struct spinlock futexlock;
+
 int nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 
 static void wakeup1(void *chan);
+static void makerunnable(struct proc *p);
 
 void pinit(void)
 {
+  struct group *g;
+
   initlock(&ptable.lock, "ptable");
+  initlock(&growlock, "growproc");
+  initlock(&futexlock, "futex");
+  for (g = ptable.group; g < &ptable.group[NPROC]; g++)
+    initsleeplock(&g->lock, "group");
 }
 
 // Must be called with interrupts disabled
@@ -90,6 +107,8 @@ allocproc(void)
 found:
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->utime = p->stime = p->wtime = 0;
+  p->nvcsw = p->nivcsw = 0;
 
   release(&ptable.lock);
 
@@ -115,13 +134,58 @@ found:
   memset(p->context, 0, sizeof *p->context);
   p->context->eip = (uint)forkret;
 
+  return p;
+}
+
+// Allocate a group with an empty wmap list and no open files.
+// Returns 0 if out of memory.
+static struct group *
+groupalloc(void)
+{
+  struct group *g;
+  struct lazy *head;
+
   // Set up mmap
-  struct lazy *head = (struct lazy *)kalloc();
+  if ((head = (struct lazy *)kalloc()) == 0)
+    return 0;
   memset(head, 0, sizeof(struct lazy));
-  p->head = head;
-  p->tail = head;
 
-  return p;
+  acquire(&ptable.lock);
+  for (g = ptable.group; g < &ptable.group[NPROC]; g++)
+  {
+    if (g->ref == 0)
+    {
+      g->ref = 1;
+      g->live = 1;
+      release(&ptable.lock);
+      g->head = head;
+      g->tail = head;
+      memset(g->ofile, 0, sizeof(g->ofile));
+      return g;
+    }
+  }
+  release(&ptable.lock);
+  kfree((char *)head);
+  return 0;
+}
+
+// Free a zombie's kernel stack and drop its reference to
+// its group, freeing the shared page table with the last one.
+// Caller must hold ptable.lock.
+static void
+freeproc(struct proc *p)
+{
+  kfree(p->kstack);
+  p->kstack = 0;
+  if (--p->group->ref == 0)
+    freevm(p->pgdir);
+  p->pgdir = 0;
+  p->group = 0;
+  p->pid = 0;
+  p->parent = 0;
+  p->name[0] = 0;
+  p->killed = 0;
+  p->state = UNUSED;
 }
 
 // PAGEBREAK: 32
@@ -134,6 +198,8 @@ void userinit(void)
   p = allocproc();
 
   initproc = p;
+  if ((p->group = groupalloc()) == 0)
+    panic("userinit: out of groups?");
   if ((p->pgdir = setupkvm()) == 0)
     panic("userinit: out of memory?");
   inituvm(p->pgdir, _binary_initcode_start, (int)_binary_initcode_size);
@@ -156,8 +222,33 @@ void userinit(void)
   // because the assignment might not be atomic.
   acquire(&ptable.lock);
 
-  p->state = RUNNABLE;
+  makerunnable(p);
+
+  release(&ptable.lock);
+}
+
+// Start a kernel thread named name that runs fn, which must
+// never return.  It has only the kernel half of a page table,
+// no parent, group or open files, and never enters user space.
+void kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+
+  if ((p = allocproc()) == 0)
+    panic("kthread: no procs");
+  if ((p->pgdir = setupkvm()) == 0)
+    panic("kthread: out of memory?");
+  p->sz = 0;
+  p->parent = 0;
+  p->group = 0;
+  p->cwd = 0;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  // forkret() returns into fn instead of trapret.
+  *(uint *)(p->context + 1) = (uint)fn;
 
+  acquire(&ptable.lock);
+  makerunnable(p);
   release(&ptable.lock);
 }
 
@@ -168,18 +259,34 @@ int growproc(int n)
   uint sz;
   struct proc *curproc = myproc();
 
+  struct proc *p;
+
+  // Threads share the page table, so serialize with them
+  // and keep every member's sz in step.
+  acquire(&growlock);
   sz = curproc->sz;
   if (n > 0)
   {
     if ((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    {
+      release(&growlock);
       return -1;
+    }
   }
   else if (n < 0)
   {
     if ((sz = deallocuvm(curproc->pgdir, sz, sz + n)) == 0)
+    {
+      release(&growlock);
       return -1;
+    }
   }
-  curproc->sz = sz;
+  acquire(&ptable.lock);
+  for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    if (p->group == curproc->group)
+      p->sz = sz;
+  release(&ptable.lock);
+  release(&growlock);
   switchuvm(curproc);
   return 0;
 }
@@ -199,19 +306,33 @@ int fork(void)
     return -1;
   }
 
+  if ((np->group = groupalloc()) == 0)
+  {
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+
   // Copy process state from proc.
   if ((np->pgdir = forkuvm(curproc->pgdir, curproc->sz)) == 0)
   {
+    kfree((char *)np->group->head);
+    acquire(&ptable.lock);
+    np->group->ref = 0;
+    release(&ptable.lock);
+    np->group = 0;
     kfree(np->kstack);
     np->kstack = 0;
     np->state = UNUSED;
     return -1;
   }
 
-  memmove(np->head, curproc->head, sizeof(struct lazy));
+  acquiresleep(&curproc->group->lock);
+  memmove(np->group->head, curproc->group->head, sizeof(struct lazy));
   
-  struct lazy* temp = curproc->head->next;
-  struct lazy* child = np->head;
+  struct lazy* temp = curproc->group->head->next;
+  struct lazy* child = np->group->head;
   while(temp) {
     memmove(child->next, temp, sizeof(struct lazy));
     child = child->next;
@@ -227,8 +348,9 @@ int fork(void)
   np->tf->eax = 0;
 
   for (i = 0; i < NOFILE; i++)
-    if (curproc->ofile[i])
-      np->ofile[i] = filedup(curproc->ofile[i]);
+    if (curproc->group->ofile[i])
+      np->group->ofile[i] = filedup(curproc->group->ofile[i]);
+  releasesleep(&curproc->group->lock);
   np->cwd = idup(curproc->cwd);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
@@ -237,13 +359,113 @@ int fork(void)
 
   acquire(&ptable.lock);
 
-  np->state = RUNNABLE;
+  makerunnable(np);
 
   release(&ptable.lock);
 
   return pid;
 }
 
+// Create a thread of the current process that shares its
+// page table, wmap regions and open files.  The thread starts
+// in fn(arg) on the one-page user stack at stack, and must
+// not return from fn (there is no caller to return to).
+// Returns the new thread's pid, or -1.
+int clone(void (*fn)(void *), void *arg, void *stack)
+{
+  struct proc *np;
+  struct proc *curproc = myproc();
+  uint sp, ustack[2];
+
+  if ((uint)stack >= curproc->sz || (uint)stack + PGSIZE > curproc->sz)
+    return -1;
+
+  if ((np = allocproc()) == 0)
+    return -1;
+
+  // Fake return PC, then the argument, at the top of the stack.
+  ustack[0] = 0xffffffff;
+  ustack[1] = (uint)arg;
+  sp = (uint)stack + PGSIZE - sizeof(ustack);
+  if (copyout(curproc->pgdir, sp, ustack, sizeof(ustack)) < 0)
+  {
+    kfree(np->kstack);
+    np->kstack = 0;
+    np->state = UNUSED;
+    return -1;
+  }
+
+  np->pgdir = curproc->pgdir;
+  np->sz = curproc->sz;
+  np->parent = curproc;
+  np->ustack = (uint)stack;
+  *np->tf = *curproc->tf;
+  np->tf->eip = (uint)fn;
+  np->tf->esp = sp;
+  np->cwd = idup(curproc->cwd);
+
+  safestrcpy(np->name, curproc->name, sizeof(curproc->name));
+
+  acquire(&ptable.lock);
+  np->group = curproc->group;
+  np->group->ref++;
+  np->group->live++;
+  makerunnable(np);
+  release(&ptable.lock);
+
+  return np->pid;
+}
+
+// Return how many threads of the current process's group
+// have not yet exited.  Only the caller can add to the count
+// (with clone), so a result of 1 stays true until it does.
+int grouplive(void)
+{
+  int n;
+
+  acquire(&ptable.lock);
+  n = myproc()->group->live;
+  release(&ptable.lock);
+  return n;
+}
+
+// Leave the current process's group for a new one holding
+// copies of its open files, so exec() can replace the page
+// table without pulling it out from under sibling threads.
+// Returns 1 if the old page table is still in use by them,
+// 0 if the process was alone and nothing was done.
+int ungroup(void)
+{
+  struct proc *curproc = myproc();
+  struct group *g, *old;
+  int fd;
+
+  acquire(&ptable.lock);
+  old = curproc->group;
+  if (old->ref == 1)
+  {
+    release(&ptable.lock);
+    return 0;
+  }
+  release(&ptable.lock);
+
+  // The old group has another member, so a free slot exists.
+  if ((g = groupalloc()) == 0)
+    panic("ungroup");
+  acquiresleep(&old->lock);
+  for (fd = 0; fd < NOFILE; fd++)
+    if (old->ofile[fd])
+      g->ofile[fd] = filedup(old->ofile[fd]);
+  releasesleep(&old->lock);
+
+  acquire(&ptable.lock);
+  old->ref--;
+  old->live--;
+  curproc->group = g;
+  release(&ptable.lock);
+  return 1;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -251,31 +473,43 @@ void exit(void)
 {
   struct proc *curproc = myproc();
   struct proc *p;
-  int fd;
+  int fd, last;
 
   if (curproc == initproc)
     panic("init exiting");
 
-  struct lazy *temp = curproc->head;
-  struct lazy *head = curproc->head;
-  while (head)
+  // Only the last thread out tears down the shared state.
+  acquire(&ptable.lock);
+  last = --curproc->group->live == 0;
+  release(&ptable.lock);
+
+  if (last)
   {
-    temp = temp->next;
-    for (int i = 0; i < head->length; i += 4096)
+    struct lazy *temp = curproc->group->head;
+    struct lazy *head = curproc->group->head;
+    while (head)
     {
-      pte_t *pte = walkpgdir(myproc()->pgdir, (char *)head->addr + i, 0);
-      kfree(P2V(PTE_ADDR(*pte)));
+      temp = temp->next;
+      for (int i = 0; i < head->length; i += 4096)
+      {
+        pte_t *pte = walkpgdir(myproc()->pgdir, (char *)head->addr + i, 0);
+        // vmsplice() and untouched pages leave holes.
+        if(pte && (*pte & PTE_P)){
+          kfree(P2V(PTE_ADDR(*pte)));
+          *pte = 0;
+        }
+      }
+      head = temp;
     }
-    head = temp;
-  }
 
-  // Close all open files.
-  for (fd = 0; fd < NOFILE; fd++)
-  {
-    if (curproc->ofile[fd])
+    // Close all open files.
+    for (fd = 0; fd < NOFILE; fd++)
     {
-      fileclose(curproc->ofile[fd]);
-      curproc->ofile[fd] = 0;
+      if (curproc->group->ofile[fd])
+      {
+        fileclose(curproc->group->ofile[fd]);
+        curproc->group->ofile[fd] = 0;
+      }
     }
   }
 
@@ -308,6 +542,7 @@ void exit(void)
 
 // Wait for a child process to exit and return its pid.
 // Return -1 if this process has no children.
+// Threads created by clone() are collected by join() instead.
 int wait(void)
 {
   struct proc *p;
@@ -321,21 +556,14 @@ int wait(void)
     havekids = 0;
     for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
     {
-      if (p->parent != curproc)
+      if (p->parent != curproc || p->group == curproc->group)
         continue;
       havekids = 1;
       if (p->state == ZOMBIE)
       {
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
-        p->kstack = 0;
-        freevm(p->pgdir);
-        p->pid = 0;
-        p->parent = 0;
-        p->name[0] = 0;
-        p->killed = 0;
-        p->state = UNUSED;
+        freeproc(p);
         release(&ptable.lock);
         return pid;
       }
@@ -352,6 +580,43 @@ int wait(void)
   }
 }
 
+// Wait for a thread created by clone() to exit and return
+// its pid, storing the user stack it was given in *stack.
+// Return -1 if this process has no threads.
+int join(uint *stack)
+{
+  struct proc *p;
+  int havekids, pid;
+  struct proc *curproc = myproc();
+
+  acquire(&ptable.lock);
+  for (;;)
+  {
+    havekids = 0;
+    for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
+    {
+      if (p->parent != curproc || p->group != curproc->group)
+        continue;
+      havekids = 1;
+      if (p->state == ZOMBIE)
+      {
+        pid = p->pid;
+        *stack = p->ustack;
+        freeproc(p);
+        release(&ptable.lock);
+        return pid;
+      }
+    }
+
+    if (!havekids || curproc->killed)
+    {
+      release(&ptable.lock);
+      return -1;
+    }
+    sleep(curproc, &ptable.lock);
+  }
+}
+
 // PAGEBREAK: 42
 //  Per-CPU process scheduler.
 //  Each CPU calls scheduler() after setting itself up.
@@ -360,10 +625,13 @@ int wait(void)
 //   - swtch to start running that process
 //   - eventually that process transfers control
 //       via swtch back to the scheduler.
+//   - if nothing was runnable, halt until an interrupt
+//       (a timer tick or a reschedule IPI from makerunnable()).
 void scheduler(void)
 {
   struct proc *p;
   struct cpu *c = mycpu();
+  int ran;
   c->proc = 0;
 
   for (;;)
@@ -372,6 +640,7 @@ void scheduler(void)
     sti();
 
     // Loop over process table looking for process to run.
+    ran = 0;
     acquire(&ptable.lock);
     for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
     {
@@ -383,7 +652,9 @@ void scheduler(void)
       // before jumping back to us.
       c->proc = p;
       switchuvm(p);
+      p->wtime += ticks - p->readytick;
       p->state = RUNNING;
+      ran = 1;
 
       swtch(&(c->scheduler), p->context);
       switchkvm();
@@ -392,7 +663,25 @@ void scheduler(void)
       // It should have changed its p->state before coming back.
       c->proc = 0;
     }
+    // Nothing was runnable for a whole scan under the lock, so any
+    // process made RUNNABLE from here on will see c->halted.
+    if (!ran)
+      c->halted = 1;
     release(&ptable.lock);
+
+    if (!ran)
+    {
+      // A reschedule IPI taken before the cli clears c->halted;
+      // one arriving after it stays pending and ends the hlt.
+      cli();
+      if (c->halted)
+      {
+        timeridle();
+        stihlt();
+        timerbusy();
+      }
+      c->halted = 0;
+    }
   }
 }
 
@@ -416,6 +705,10 @@ void sched(void)
     panic("sched running");
   if (readeflags() & FL_IF)
     panic("sched interruptible");
+  if (p->state == RUNNABLE)
+    p->nivcsw++;
+  else
+    p->nvcsw++;
   intena = mycpu()->intena;
   swtch(&p->context, mycpu()->scheduler);
   mycpu()->intena = intena;
@@ -426,6 +719,7 @@ void yield(void)
 {
   acquire(&ptable.lock); // DOC: yieldlock
   myproc()->state = RUNNABLE;
+  myproc()->readytick = ticks;
   sched();
   release(&ptable.lock);
 }
@@ -444,8 +738,9 @@ void forkret(void)
     // of a regular process (e.g., they call sleep), and thus cannot
     // be run from main().
     first = 0;
-    iinit(ROOTDEV);
+    // Recover the log first, since iinit reads the bitmap.
     initlog(ROOTDEV);
+    iinit(ROOTDEV);
   }
 
   // Return to "caller", actually trapret (see allocproc).
@@ -501,7 +796,28 @@ wakeup1(void *chan)
 
   for (p = ptable.proc; p < &ptable.proc[NPROC]; p++)
     if (p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+      makerunnable(p);
+}
+
+// Make p RUNNABLE and note when it started waiting for a CPU.
+// If another CPU is halted in scheduler(), interrupt it so
+// that it runs p.  The ptable lock must be held.
+static void
+makerunnable(struct proc *p)
+{
+  struct cpu *c;
+
+  p->state = RUNNABLE;
+  p->readytick = ticks;
+  for (c = cpus; c < cpus + ncpu; c++)
+  {
+    if (c != mycpu() && c->halted)
+    {
+      c->halted = 0;
+      lapicipi(c->apicid, T_IRQ0 + IRQ_RESCHED);
+      return;
+    }
+  }
 }
 
 // Wake up all processes sleeping on chan.
@@ -527,7 +843,7 @@ int kill(int pid)
       p->killed = 1;
       // Wake process from sleep if necessary.
       if (p->state == SLEEPING)
-        p->state = RUNNABLE;
+        makerunnable(p);
       release(&ptable.lock);
       return 0;
     }
@@ -536,19 +852,111 @@ int kill(int pid)
   return -1;
 }
 
+// Futexes.  A futex is a word of user memory; waiters sleep on
+// the kernel address of the word, which is fixed by the physical
+// frame, so processes sharing the frame through MAP_SHARED wmap
+// memory (and threads sharing a page table) share the futex.
+// The caller must make sure the page at addr is present.
+static int *
+futexword(uint addr)
+{
+  char *page;
+
+  if ((page = uva2ka(myproc()->pgdir, (char *)PGROUNDDOWN(addr))) == 0)
+    return 0;
+  return (int *)(page + (addr % PGSIZE));
+}
+
+// Sleep until woken by futexwake() if the word at addr still
+// holds val.  Return -1 at once if it does not.
+int futexwait(uint addr, int val)
+{
+  int *w;
+
+  acquire(&futexlock);
+  if ((w = futexword(addr)) == 0 || *w != val || myproc()->killed)
+  {
+    release(&futexlock);
+    return -1;
+  }
+  sleep(w, &futexlock);
+  release(&futexlock);
+  return 0;
+}
+
+// Wake at most n processes waiting on the word at addr.
+// Return the number woken.
+int futexwake(uint addr, int n)
+{
+  struct proc *p;
+  int *w, woken;
+
+  acquire(&futexlock);
+  if ((w = futexword(addr)) == 0)
+  {
+    release(&futexlock);
+    return -1;
+  }
+  woken = 0;
+  acquire(&ptable.lock);
+  for (p = ptable.proc; p < &ptable.proc[NPROC] && woken < n; p++)
+  {
+    if (p->state == SLEEPING && p->chan == w)
+    {
+      makerunnable(p);
+      woken++;
+    }
+  }
+  release(&ptable.lock);
+  release(&futexlock);
+  return woken;
+}
+
+static char *states[] = {
+    [UNUSED] "unused",
+    [EMBRYO] "embryo",
+    [SLEEPING] "sleep ",
+    [RUNNABLE] "runble",
+    [RUNNING] "run   ",
+    [ZOMBIE] "zombie"};
+
+// Copy accounting for up to n processes into pi.
+// Returns the number of entries filled in.
+int getprocinfo(struct procinfo *pi, int n)
+{
+  struct proc *p;
+  int i;
+
+  i = 0;
+  acquire(&ptable.lock);
+  for (p = ptable.proc; p < &ptable.proc[NPROC] && i < n; p++)
+  {
+    if (p->state == UNUSED)
+      continue;
+    pi[i].pid = p->pid;
+    pi[i].ppid = p->parent ? p->parent->pid : 0;
+    safestrcpy(pi[i].state, states[p->state], sizeof(pi[i].state));
+    safestrcpy(pi[i].name, p->name, sizeof(pi[i].name));
+    pi[i].sz = p->sz;
+    pi[i].utime = p->utime;
+    pi[i].stime = p->stime;
+    pi[i].wtime = p->wtime;
+    if (p->state == RUNNABLE)
+      pi[i].wtime += ticks - p->readytick;
+    pi[i].nvcsw = p->nvcsw;
+    pi[i].nivcsw = p->nivcsw;
+    i++;
+  }
+  release(&ptable.lock);
+  return i;
+}
+
 // PAGEBREAK: 36
 //  Print a process listing to console.  For debugging.
 //  Runs when user types ^P on console.
 //  No lock to avoid wedging a stuck machine further.
 void procdump(void)
 {
-  static char *states[] = {
-      [UNUSED] "unused",
-      [EMBRYO] "embryo",
-      [SLEEPING] "sleep ",
-      [RUNNABLE] "runble",
-      [RUNNING] "run   ",
-      [ZOMBIE] "zombie"};
   int i;
   struct proc *p;
   char *state;
@@ -1,6 +1,8 @@
 #ifndef PROC_H
 #define PROC_H
 
+#include "sleeplock.h"
+
 // Per-CPU state
 struct cpu {
   uchar apicid;                // Local APIC ID
@@ -11,6 +13,13 @@ struct cpu {
   int ncli;                    // Depth of pushcli nesting.
   int intena;                  // Were interrupts enabled before pushcli?
   struct proc *proc;           // The process running on this cpu or null
+  volatile int halted;         // Idle in hlt, waiting for a reschedule IPI
+  uint idleticks;              // Timer ticks with no process running
+  uint busyticks;              // Timer ticks spent running a process
+  struct proc *timerq;         // Sleeping procs by deadline (timerlock)
+  uint64 nexttick;             // Microsecond time of the next tick
+  uint64 idlestart;            // When the tick was stopped, if tickless
+  int tickless;                // Tick stopped while halted
 };
 
 extern struct cpu cpus[NCPU];
@@ -49,6 +58,21 @@ struct lazy {                // Lazy allocation struct
   struct lazy* prev;
 }; //lazy
 
+// State shared by a process and the threads it creates with
+// clone(): the wmap regions and the open file table.
+// The page table is shared too, through proc->pgdir.
+// ref and live are protected by ptable.lock; lock protects
+// the rest, and is a sleeplock because the page fault path
+// reads file-backed pages while holding it.
+struct group {
+  int ref;                     // procs (including zombies) using this
+  int live;                    // procs that have not yet exited
+  struct sleeplock lock;
+  struct lazy* head;           // All lazy allocations of the group
+  struct lazy* tail;
+  struct file *ofile[NOFILE];  // Open files
+};
+
 // Per-process state
 struct proc {
   uint sz;                     // Size of process memory (bytes)
@@ -61,16 +85,24 @@ struct proc {
   struct context *context;     // swtch() here to run process
   void *chan;                  // If non-zero, sleeping on chan
   int killed;                  // If non-zero, have been killed
-  struct file *ofile[NOFILE];  // Open files
+  struct group *group;         // Address space and open files
+  uint ustack;                 // User stack passed to clone()
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
   uint n_upages;               // the number of allocated physical pages in the process's user address space
   uint va[32]; 	   			   // the virtual addresses of the allocated physical pages in the process's user address space
   uint pa[32];                 // the physical addresses of the allocated physical pages in the process's user address space
-
-  
-  struct lazy* head;  // All lazy allocations of a process (16 max)
-  struct lazy* tail;
+  uint utime;                  // Timer ticks charged while in user mode
+  uint stime;                  // Timer ticks charged while in the kernel
+  uint wtime;                  // Ticks spent RUNNABLE waiting for a CPU
+  uint readytick;              // Value of ticks when last made RUNNABLE
+  uint nvcsw;                  // Voluntary context switches (sleep, exit)
+  uint nivcsw;                 // Involuntary context switches (preemption)
+  uint64 deadline;             // Wake-up time in timersleep()
+  struct proc *tnext;          // Next on timercpu->timerq
+  struct cpu *timercpu;        // CPU whose timer queue holds this proc
+  int logres;                  // Log blocks reserved by begin_opn()
+  int pollev;                  // A polled file changed (polllock)
 };
 
 // Process memory is laid out contiguously, low addresses first:
@@ -0,0 +1,42 @@
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+
+// Process and CPU accounting, in timer ticks, and buffer
+// cache counters.
+
+struct procinfo pi[NPROC];
+
+int
+main(int argc, char *argv[])
+{
+  struct cpustat cs;
+  struct bcachestat bs;
+  int i, n;
+
+  if((n = getprocinfo(pi, NPROC)) < 0){
+    printf(2, "ps: getprocinfo failed\n");
+    exit();
+  }
+  printf(1, "PID PPID STATE  USER SYS WAIT VCSW IVCSW SIZE NAME\n");
+  for(i = 0; i < n; i++)
+    printf(1, "%d %d %s %d %d %d %d %d %d %s\n",
+           pi[i].pid, pi[i].ppid, pi[i].state, pi[i].utime, pi[i].stime,
+           pi[i].wtime, pi[i].nvcsw, pi[i].nivcsw, pi[i].sz, pi[i].name);
+
+  if(getcpustat(&cs) < 0){
+    printf(2, "ps: getcpustat failed\n");
+    exit();
+  }
+  for(i = 0; i < cs.ncpu; i++)
+    printf(1, "cpu%d: busy %d idle %d\n", i, cs.busy[i], cs.idle[i]);
+
+  if(getbcachestat(&bs) < 0){
+    printf(2, "ps: getbcachestat failed\n");
+    exit();
+  }
+  printf(1, "bcache: %d bufs, %d hits %d misses %d evictions\n",
+         bs.nbuf, bs.hits, bs.misses, bs.evictions);
+  exit();
+}
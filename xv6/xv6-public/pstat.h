@@ -0,0 +1,36 @@
+#ifndef PSTAT_H
+#define PSTAT_H
+
+// Scheduling statistics returned to user space.
+
+// for `getcpustat`
+#define MAX_CPU_INFO 8
+struct cpustat {
+	int ncpu;				  // Number of CPUs started
+	uint idle[MAX_CPU_INFO];  // Timer ticks each CPU spent with nothing to run
+	uint busy[MAX_CPU_INFO];  // Timer ticks each CPU spent running a process
+};
+
+// for `getprocinfo`
+struct procinfo {
+	int pid;
+	int ppid;				  // Parent's pid, 0 if none
+	char state[8];			  // As printed by procdump()
+	char name[16];
+	uint sz;				  // Size of process memory (bytes)
+	uint utime;				  // Timer ticks charged in user mode
+	uint stime;				  // Timer ticks charged in the kernel
+	uint wtime;				  // Ticks spent RUNNABLE but not running
+	uint nvcsw;				  // Voluntary context switches
+	uint nivcsw;			  // Involuntary context switches
+};
+
+// for `getbcachestat`
+struct bcachestat {
+	int nbuf;				  // Buffers in the cache
+	uint hits;				  // bread()s satisfied from the cache
+	uint misses;			  // bread()s that had to recycle a buffer
+	uint evictions;			  // Misses that displaced a cached block
+};
+
+#endif /* PSTAT_H */
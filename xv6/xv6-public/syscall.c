@@ -108,6 +108,24 @@ extern int sys_wunmap(void);
 extern int sys_wremap(void);
 extern int sys_getpgdirinfo(void);
 extern int sys_getwmapinfo(void);
+extern int sys_clone(void);
+extern int sys_join(void);
+extern int sys_futex_wait(void);
+extern int sys_futex_wake(void);
+extern int sys_getcpustat(void);
+extern int sys_getprocinfo(void);
+extern int sys_nanosleep(void);
+extern int sys_clock_gettime(void);
+extern int sys_getbcachestat(void);
+extern int sys_fsync(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
+extern int sys_readv(void);
+extern int sys_writev(void);
+extern int sys_sendfile(void);
+extern int sys_fcntl(void);
+extern int sys_vmsplice(void);
+extern int sys_poll(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -136,6 +154,24 @@ static int (*syscalls[])(void) = {
 [SYS_wremap]  sys_wremap,
 [SYS_getpgdirinfo] sys_getpgdirinfo,
 [SYS_getwmapinfo] sys_getwmapinfo,
+[SYS_clone]   sys_clone,
+[SYS_join]    sys_join,
+[SYS_futex_wait] sys_futex_wait,
+[SYS_futex_wake] sys_futex_wake,
+[SYS_getcpustat] sys_getcpustat,
+[SYS_getprocinfo] sys_getprocinfo,
+[SYS_nanosleep] sys_nanosleep,
+[SYS_clock_gettime] sys_clock_gettime,
+[SYS_getbcachestat] sys_getbcachestat,
+[SYS_fsync]   sys_fsync,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
+[SYS_readv]   sys_readv,
+[SYS_writev]  sys_writev,
+[SYS_sendfile] sys_sendfile,
+[SYS_fcntl]   sys_fcntl,
+[SYS_vmsplice] sys_vmsplice,
+[SYS_poll]    sys_poll,
 };
 
 void
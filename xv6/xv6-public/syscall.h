@@ -25,3 +25,21 @@
 #define SYS_wremap 24
 #define SYS_getpgdirinfo 25
 #define SYS_getwmapinfo 26
+#define SYS_clone  27
+#define SYS_join   28
+#define SYS_futex_wait 29
+#define SYS_futex_wake 30
+#define SYS_getcpustat 31
+#define SYS_getprocinfo 32
+#define SYS_nanosleep 33
+#define SYS_clock_gettime 34
+#define SYS_getbcachestat 35
+#define SYS_fsync  36
+#define SYS_pread  37
+#define SYS_pwrite 38
+#define SYS_readv  39
+#define SYS_writev 40
+#define SYS_sendfile 41
+#define SYS_fcntl  42
+#define SYS_vmsplice 43
+#define SYS_poll   44
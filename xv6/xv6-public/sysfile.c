@@ -15,23 +15,36 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "poll.h"
+#include "uio.h"
+
+// Return the file open as fd, with a reference of its own
+// so that a thread closing fd meanwhile cannot free it, or
+// 0 if fd is not open.  Release with fileclose().
+static struct file*
+fdget(int fd)
+{
+  struct group *g = myproc()->group;
+  struct file *f;
+
+  if(fd < 0 || fd >= NOFILE)
+    return 0;
+  acquiresleep(&g->lock);
+  if((f = g->ofile[fd]) != 0)
+    filedup(f);
+  releasesleep(&g->lock);
+  return f;
+}
 
 // Fetch the nth word-sized system call argument as a file descriptor
-// and return both the descriptor and the corresponding struct file.
+// and return the corresponding struct file, as fdget() does.
 static int
-argfd(int n, int *pfd, struct file **pf)
+argfd(int n, struct file **pf)
 {
   int fd;
-  struct file *f;
 
-  if(argint(n, &fd) < 0)
-    return -1;
-  if(fd < 0 || fd >= NOFILE || (f=myproc()->ofile[fd]) == 0)
+  if(argint(n, &fd) < 0 || (*pf = fdget(fd)) == 0)
     return -1;
-  if(pfd)
-    *pfd = fd;
-  if(pf)
-    *pf = f;
   return 0;
 }
 
@@ -41,14 +54,17 @@ static int
 fdalloc(struct file *f)
 {
   int fd;
-  struct proc *curproc = myproc();
+  struct group *g = myproc()->group;
 
+  acquiresleep(&g->lock);
   for(fd = 0; fd < NOFILE; fd++){
-    if(curproc->ofile[fd] == 0){
-      curproc->ofile[fd] = f;
+    if(g->ofile[fd] == 0){
+      g->ofile[fd] = f;
+      releasesleep(&g->lock);
       return fd;
     }
   }
+  releasesleep(&g->lock);
   return -1;
 }
 
@@ -58,11 +74,10 @@ sys_dup(void)
   struct file *f;
   int fd;
 
-  if(argfd(0, 0, &f) < 0)
+  if(argfd(0, &f) < 0)
     return -1;
   if((fd=fdalloc(f)) < 0)
-    return -1;
-  filedup(f);
+    fileclose(f);
   return fd;
 }
 
@@ -73,9 +88,11 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argfd(0, &f) < 0)
     return -1;
-  return fileread(f, p, n);
+  n = fileread(f, p, n);
+  fileclose(f);
+  return n;
 }
 
 int
@@ -85,9 +102,203 @@ sys_write(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argint(2, &n) < 0 || argptr(1, &p, n) < 0 || argfd(0, &f) < 0)
+    return -1;
+  n = filewrite(f, p, n);
+  fileclose(f);
+  return n;
+}
+
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0 || argfd(0, &f) < 0)
+    return -1;
+  n = filepread(f, p, n, off);
+  fileclose(f);
+  return n;
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0 || argfd(0, &f) < 0)
+    return -1;
+  n = filepwrite(f, p, n, off);
+  fileclose(f);
+  return n;
+}
+
+// Fetch the nth system call argument as an array of cnt
+// iovecs, copy it to iov, and check that the buffers lie
+// within the process address space.
+static int
+argiovec(int n, int cnt, struct iovec *iov)
+{
+  struct proc *curproc = myproc();
+  char *p;
+  uint base;
+  int i;
+
+  if(cnt < 0 || cnt > IOV_MAX || argptr(n, &p, cnt*sizeof(*iov)) < 0)
+    return -1;
+  memmove(iov, p, cnt*sizeof(*iov));
+  for(i = 0; i < cnt; i++){
+    base = (uint)iov[i].iov_base;
+    if(iov[i].iov_len < 0)
+      return -1;
+    if(iov[i].iov_len > 0 &&
+       (base >= curproc->sz || base + iov[i].iov_len > curproc->sz ||
+        base + iov[i].iov_len < base))
+      return -1;
+  }
+  return 0;
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argint(2, &cnt) < 0 || argiovec(1, cnt, iov) < 0 || argfd(0, &f) < 0)
     return -1;
-  return filewrite(f, p, n);
+  cnt = filereadv(f, iov, cnt);
+  fileclose(f);
+  return cnt;
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[IOV_MAX];
+  int cnt;
+
+  if(argint(2, &cnt) < 0 || argiovec(1, cnt, iov) < 0 || argfd(0, &f) < 0)
+    return -1;
+  cnt = filewritev(f, iov, cnt);
+  fileclose(f);
+  return cnt;
+}
+
+// sendfile(out, in, off, n): copy n bytes of in to out
+// without passing them through user memory.
+int
+sys_sendfile(void)
+{
+  struct file *out, *in;
+  int off, n;
+
+  if(argint(2, &off) < 0 || argint(3, &n) < 0 || n < 0 || argfd(0, &out) < 0)
+    return -1;
+  if(argfd(1, &in) < 0){
+    fileclose(out);
+    return -1;
+  }
+  n = filesendfile(out, in, off, n);
+  fileclose(out);
+  fileclose(in);
+  return n;
+}
+
+// vmsplice(fd, addr, n): move the pages at [addr, addr+n) of
+// an anonymous wmap region into the pipe fd writes to, or
+// fill them from the pipe fd reads from, by remapping whole
+// pages where the pipe's ring allows.  Fails if the
+// process has other live threads.
+int
+sys_vmsplice(void)
+{
+  struct file *f;
+  struct lazy *r;
+  int addr, n;
+
+  if(argint(1, &addr) < 0 || argint(2, &n) < 0 || argfd(0, &f) < 0)
+    return -1;
+  // wmapswap() flushes only this CPU's TLB, so a sibling
+  // thread could keep using a page after it has moved.
+  if(f->type != FD_PIPE || n <= 0 || addr % PGSIZE || n % PGSIZE ||
+     grouplive() > 1 || (r = wmapregion(addr, n)) == 0)
+    n = -1;
+  else if(f->writable)
+    n = pipegift(f->pipe, r, addr, n);
+  else
+    n = pipetake(f->pipe, r, addr, n);
+  fileclose(f);
+  return n;
+}
+
+int
+sys_fcntl(void)
+{
+  struct file *f;
+  int cmd, arg;
+
+  if(argint(1, &cmd) < 0 || argint(2, &arg) < 0 || argfd(0, &f) < 0)
+    return -1;
+  arg = f->type == FD_PIPE ? pipefcntl(f->pipe, cmd, arg) : -1;
+  fileclose(f);
+  return arg;
+}
+
+// poll(fds, n, timeout): wait until one of the n files in
+// fds is ready for what its events ask, or for timeout ms
+// (forever if timeout is negative), and return how many are.
+int
+sys_poll(void)
+{
+  struct pollfd *fds;
+  struct pollent pe[NOFILE];
+  struct file *fp[NOFILE];
+  uint64 deadline;
+  int i, n, timeout, nready;
+
+  if(argint(1, &n) < 0 || n < 0 || n > NOFILE ||
+     argptr(0, (char**)&fds, n*sizeof(*fds)) < 0 || argint(2, &timeout) < 0)
+    return -1;
+  deadline = timeout > 0 ? microtime() + (uint64)timeout*1000 : 0;
+  for(i = 0; i < n; i++)
+    pe[i].q = 0;
+
+  for(;;){
+    pollstart();
+    nready = 0;
+    // Hold each file until polldone(), so a close() in
+    // another thread cannot free the waitq pe[i] is on.
+    for(i = 0; i < n; i++){
+      if((fp[i] = fdget(fds[i].fd)) == 0)
+        fds[i].revents = POLLNVAL;
+      else
+        fds[i].revents = filepoll(fp[i], fds[i].events,
+                                  nready == 0 && timeout != 0 ? &pe[i] : 0);
+      if(fds[i].revents)
+        nready++;
+    }
+    if(nready == 0 && timeout != 0 && !myproc()->killed &&
+       (deadline == 0 || microtime() < deadline))
+      pollsleep(deadline);
+    for(i = 0; i < n; i++){
+      polldone(&pe[i]);
+      if(fp[i])
+        fileclose(fp[i]);
+    }
+    if(nready || timeout == 0 || myproc()->killed ||
+       (deadline && microtime() >= deadline))
+      break;
+  }
+  return myproc()->killed && nready == 0 ? -1 : nready;
 }
 
 int
@@ -95,10 +306,16 @@ sys_close(void)
 {
   int fd;
   struct file *f;
+  struct group *g = myproc()->group;
 
-  if(argfd(0, &fd, &f) < 0)
+  if(argint(0, &fd) < 0 || fd < 0 || fd >= NOFILE)
+    return -1;
+  acquiresleep(&g->lock);
+  if((f = g->ofile[fd]) != 0)
+    g->ofile[fd] = 0;
+  releasesleep(&g->lock);
+  if(f == 0)
     return -1;
-  myproc()->ofile[fd] = 0;
   fileclose(f);
   return 0;
 }
@@ -108,10 +325,28 @@ sys_fstat(void)
 {
   struct file *f;
   struct stat *st;
+  int r;
+
+  if(argptr(1, (void*)&st, sizeof(*st)) < 0 || argfd(0, &f) < 0)
+    return -1;
+  r = filestat(f, st);
+  fileclose(f);
+  return r;
+}
+
+// Wait until the file system changes made so far, including
+// those to fd, are on disk.  The log commits everything
+// together, so this does not depend on fd.
+int
+sys_fsync(void)
+{
+  struct file *f;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, &f) < 0)
     return -1;
-  return filestat(f, st);
+  log_force();
+  fileclose(f);
+  return 0;
 }
 
 // Create the path new as a link to the same inode as old.
@@ -218,6 +453,7 @@ sys_unlink(void)
   memset(&de, 0, sizeof(de));
   if(writei(dp, (char*)&de, off, sizeof(de)) != sizeof(de))
     panic("unlink: writei");
+  dcinval(dp, name);
   if(ip->type == T_DIR){
     dp->nlink--;
     iupdate(dp);
@@ -339,7 +575,7 @@ sys_mkdir(void)
   struct inode *ip;
 
   begin_op();
-  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
+  if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, DIRHASH, 0)) == 0){
     end_op();
     return -1;
   }
@@ -432,8 +668,11 @@ sys_pipe(void)
     return -1;
   fd0 = -1;
   if((fd0 = fdalloc(rf)) < 0 || (fd1 = fdalloc(wf)) < 0){
-    if(fd0 >= 0)
-      myproc()->ofile[fd0] = 0;
+    if(fd0 >= 0){
+      acquiresleep(&myproc()->group->lock);
+      myproc()->group->ofile[fd0] = 0;
+      releasesleep(&myproc()->group->lock);
+    }
     fileclose(rf);
     fileclose(wf);
     return -1;
@@ -9,6 +9,7 @@
 #include "date.h"
 #include "wmap.h"
 #include "file.h"
+#include "pstat.h"
 
 #define PAGE_SIZE 4096
 
@@ -42,6 +43,77 @@ int sys_getpid(void)
 	return myproc()->pid;
 }
 
+int sys_clone(void)
+{
+	char *fcn, *arg, *stack;
+
+	if (argint(0, (int *)&fcn) < 0 || argint(1, (int *)&arg) < 0 ||
+		argptr(2, &stack, PGSIZE) < 0)
+		return -1;
+	return clone((void (*)(void *))fcn, arg, stack);
+}
+
+// Check that the word at addr lies in the process image or in
+// one of its wmap regions, and fault its page in so the futex
+// code can find the frame without sleeping under a spinlock.
+static int
+argfutex(int n, uint *paddr)
+{
+	int addr;
+	struct lazy *l;
+
+	if (argint(n, &addr) < 0 || addr % sizeof(int) != 0)
+		return -1;
+	if ((uint)addr + sizeof(int) > myproc()->sz)
+	{
+		acquiresleep(&myproc()->group->lock);
+		for (l = myproc()->group->head; l; l = l->next)
+			if (l->used && addr >= l->addr && addr + sizeof(int) <= l->addr + l->length)
+				break;
+		releasesleep(&myproc()->group->lock);
+		if (l == 0)
+			return -1;
+	}
+	// The fault path takes the group lock, so touch the
+	// page only after releasing it.
+	(void)*(volatile int *)addr;
+	*paddr = addr;
+	return 0;
+}
+
+int sys_futex_wait(void)
+{
+	uint addr;
+	int val;
+
+	if (argfutex(0, &addr) < 0 || argint(1, &val) < 0)
+		return -1;
+	return futexwait(addr, val);
+}
+
+int sys_futex_wake(void)
+{
+	uint addr;
+	int n;
+
+	if (argfutex(0, &addr) < 0 || argint(1, &n) < 0)
+		return -1;
+	return futexwake(addr, n);
+}
+
+int sys_join(void)
+{
+	void **stack;
+	uint ustack;
+	int pid;
+
+	if (argptr(0, (void *)&stack, sizeof(*stack)) < 0)
+		return -1;
+	if ((pid = join(&ustack)) >= 0)
+		*stack = (void *)ustack;
+	return pid;
+}
+
 int sys_sbrk(void)
 {
 	int addr;
@@ -77,6 +149,31 @@ int sys_sleep(void)
 	return 0;
 }
 
+// Sleep with microsecond resolution on the LAPIC timer.
+int sys_nanosleep(void)
+{
+	struct timespec *req;
+
+	if (argptr(0, (void *)&req, sizeof(*req)) < 0)
+		return -1;
+	if (req->nsec >= 1000000000)
+		return -1;
+	return timersleep((uint64)req->sec * 1000000 + (req->nsec + 999) / 1000);
+}
+
+int sys_clock_gettime(void)
+{
+	int clk;
+	struct timespec *ts;
+
+	if (argint(0, &clk) < 0 || argptr(1, (void *)&ts, sizeof(*ts)) < 0)
+		return -1;
+	if (clk != CLOCK_MONOTONIC)
+		return -1;
+	clockread(ts);
+	return 0;
+}
+
 // return how many clock tick interrupts have occurred
 // since start.
 int sys_uptime(void)
@@ -89,7 +186,7 @@ int sys_uptime(void)
 	return xticks;
 }
 
-uint sys_wmap(void)
+static uint dowmap(void)
 {
 	// decl args
 	int tAddr;
@@ -111,8 +208,8 @@ uint sys_wmap(void)
 	// NEW: commented this line out
 	// PGROUNDUP(addr);
 
-	struct lazy *temp = myproc()->head;
-	struct lazy *tail = myproc()->tail;
+	struct lazy *temp = myproc()->group->head;
+	struct lazy *tail = myproc()->group->tail;
 
 	// myproc() use to retrieve proc struct
 	if(addr >= MMAPBASE){
@@ -127,7 +224,7 @@ uint sys_wmap(void)
 			temp->length = length;
 			temp->fd = (flags & MAP_ANONYMOUS) ? -1 : fd;
 			temp->shared = (flags & MAP_SHARED) ? 1 : 0;
-			myproc()->tail = temp;
+			myproc()->group->tail = temp;
 			return addr;
 		}
 		uint last = 0;
@@ -154,7 +251,7 @@ uint sys_wmap(void)
 					temp->prev = new;
 				}
 				if(last == 0) {
-					myproc()->head = new;
+					myproc()->group->head = new;
 				}
 				return addr;
 			}
@@ -176,11 +273,11 @@ uint sys_wmap(void)
 			new->used = 1;
 			tail->next = new;
 			new->prev = tail;
-			myproc()->tail = new;
+			myproc()->group->tail = new;
 			return addr;
 		}
 	}
-	temp = myproc()->head;
+	temp = myproc()->group->head;
 	if(!(MAP_FIXED & flags))
 	{
 		uint start = MMAPBASE;
@@ -208,7 +305,7 @@ uint sys_wmap(void)
 					temp->prev = new;
 				}
 				if(start == MMAPBASE) {
-					myproc()->head = new;
+					myproc()->group->head = new;
 				}
 				return start;
 			}
@@ -226,14 +323,14 @@ uint sys_wmap(void)
 			new->used = 1;
 			new->prev = tail;
 			tail->next = new;
-			myproc()->tail = new;
+			myproc()->group->tail = new;
 			return start;
 		}
 	}
 	return -1;
 }
 
-int sys_wunmap(void)
+static int dowunmap(void)
 {
 	int taddr;
 	argint(0, &taddr);
@@ -244,7 +341,7 @@ int sys_wunmap(void)
 	{
 		return -1;
 	}
-	struct lazy *temp = myproc()->head;
+	struct lazy *temp = myproc()->group->head;
 	while (temp)
 	{
 		if (temp->addr == addr)
@@ -266,7 +363,7 @@ int sys_wunmap(void)
 			{
 				struct lazy *new = (struct lazy *)kalloc();
 				memset(new, 0, sizeof(struct lazy));
-				myproc()->head = new;
+				myproc()->group->head = new;
 			}
 			if (temp->fd == -1 || temp->shared == 0)
 			{ // UPDATES PTE'S (removes)
@@ -281,15 +378,14 @@ int sys_wunmap(void)
 			}
 			else
 			{
-				struct file *f = myproc()->ofile[temp->fd];
+				struct file *f = myproc()->group->ofile[temp->fd];
 				for (int i = 0; i < temp->length; i += 4096)
 				{
 					pte_t *pte = walkpgdir(myproc()->pgdir, (char *)addr + i, 0);
 					if (*pte & PTE_P)
 					{
 						char* buf = P2V(PTE_ADDR(*pte));
-						f->off = i;
-						filewrite(f, (char *)buf, 4096);
+						filepwrite(f, (char *)buf, 4096, i);
 						kfree(buf);
 						*pte = 0;
 					}
@@ -324,7 +420,7 @@ int sys_wunmap(void)
 	return -1;
 }
 
-uint sys_wremap(void)
+static uint dowremap(void)
 {
 	int tempoldaddr;
 	uint oldaddr;
@@ -349,7 +445,7 @@ uint sys_wremap(void)
 		return -1;
 	}
 
-	struct lazy *temp = myproc()->head;
+	struct lazy *temp = myproc()->group->head;
 	while (temp)
 	{
 		if (temp->addr == oldaddr)
@@ -370,7 +466,7 @@ uint sys_wremap(void)
 			}
 			else if (flags & MREMAP_MAYMOVE)
 			{
-				struct lazy *temp2 = myproc()->head;
+				struct lazy *temp2 = myproc()->group->head;
 
 				// NOTE: don't think this is correct logic using start=0
 				int start = 0;
@@ -438,6 +534,83 @@ uint sys_wremap(void)
 	return -1;
 }
 
+// The wmap list belongs to the whole group, so threads change
+// it one at a time.
+uint sys_wmap(void)
+{
+	struct group *g = myproc()->group;
+	uint r;
+
+	acquiresleep(&g->lock);
+	r = dowmap();
+	releasesleep(&g->lock);
+	return r;
+}
+
+int sys_wunmap(void)
+{
+	struct group *g = myproc()->group;
+	int r;
+
+	acquiresleep(&g->lock);
+	r = dowunmap();
+	releasesleep(&g->lock);
+	return r;
+}
+
+uint sys_wremap(void)
+{
+	struct group *g = myproc()->group;
+	uint r;
+
+	acquiresleep(&g->lock);
+	r = dowremap();
+	releasesleep(&g->lock);
+	return r;
+}
+
+// Per-CPU idle and busy timer tick counts.
+int sys_getcpustat(void)
+{
+	struct cpustat *cs;
+	int i;
+
+	if (argptr(0, (void *)&cs, sizeof(*cs)) < 0)
+		return -1;
+	cs->ncpu = ncpu < MAX_CPU_INFO ? ncpu : MAX_CPU_INFO;
+	for (i = 0; i < cs->ncpu; i++)
+	{
+		cs->idle[i] = cpus[i].idleticks;
+		cs->busy[i] = cpus[i].busyticks;
+	}
+	return 0;
+}
+
+int sys_getbcachestat(void)
+{
+	struct bcachestat *st;
+
+	if (argptr(0, (void *)&st, sizeof(*st)) < 0)
+		return -1;
+	bstat(st);
+	return 0;
+}
+
+// Fill in accounting for up to n processes; return how many.
+int sys_getprocinfo(void)
+{
+	struct procinfo *pi;
+	int n;
+
+	if (argint(1, &n) < 0 || n < 0)
+		return -1;
+	if (n > NPROC)
+		n = NPROC;
+	if (argptr(0, (void *)&pi, n * sizeof(*pi)) < 0)
+		return -1;
+	return getprocinfo(pi, n);
+}
+
 // NEW: fixed type casting
 // NOTE: add return -1 for failure case?
 int sys_getpgdirinfo(void)
@@ -489,22 +662,28 @@ int sys_getpgdirinfo(void)
 int sys_getwmapinfo(void)
 {
 	int addr;
-	struct wmapinfo *wminfo;
+	struct wmapinfo *wminfo, info;
 
 	argint(0, &addr);
 	wminfo = (struct wmapinfo *)addr;
 	
+	// Fill a copy under the group lock, since writing to
+	// wminfo may fault, and the fault path takes that lock.
 	int count = 0;
-	struct lazy *temp = myproc()->head;
-	while (temp && temp->used == 1)
+	memset(&info, 0, sizeof(info));
+	acquiresleep(&myproc()->group->lock);
+	struct lazy *temp = myproc()->group->head;
+	while (temp && temp->used == 1 && count < MAX_WMMAP_INFO)
 	{
 		count++;
-		wminfo->addr[count-1] = temp->addr;
-		wminfo->length[count-1] = temp->length;
-		wminfo->n_loaded_pages[count-1] = temp->numPages;
-		wminfo->total_mmaps++;
+		info.addr[count-1] = temp->addr;
+		info.length[count-1] = temp->length;
+		info.n_loaded_pages[count-1] = temp->numPages;
+		info.total_mmaps++;
 
 		temp = temp->next;
 	}
+	releasesleep(&myproc()->group->lock);
+	*wminfo = info;
 	return 0;
 }
@@ -0,0 +1,274 @@
+// High-resolution timers.
+//
+// The local APIC timer runs in one-shot mode.  timerinit()
+// calibrates it, and the TSC, against the PIT, so that deadlines
+// can be given in microseconds.  Each CPU keeps a queue of
+// processes sleeping in timersleep(), ordered by deadline, and
+// programs its timer for the earlier of the next scheduler tick
+// and the first deadline.  With TICKLESS set, a CPU other than
+// cpu0 stops its tick while halted in scheduler().
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "date.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "x86.h"
+
+// PIT channel 2 runs at PIT_HZ and its gate and output
+// are in the keyboard controller's port B.
+#define PIT_HZ     1193182
+#define PIT_CH2    0x42
+#define PIT_MODE   0x43
+#define PIT_PORTB  0x61
+#define CALIBUS    10000   // calibrate over 10ms
+
+static struct spinlock timerlock;
+static uint lapicperus;   // LAPIC timer counts per microsecond
+static uint tscperus;     // TSC counts per microsecond
+static uint64 tscboot;
+
+// 64-by-32-bit division, since the kernel is not linked
+// against libgcc's __udivdi3.
+static uint64
+div64(uint64 n, uint d, uint *rem)
+{
+  uint hi, lo, r;
+
+  hi = n >> 32;
+  r = hi % d;
+  hi /= d;
+  asm("divl %4" : "=a" (lo), "=d" (r) : "a" ((uint)n), "d" (r), "rm" (d));
+  if(rem)
+    *rem = r;
+  return ((uint64)hi << 32) | lo;
+}
+
+// Busy-wait CALIBUS microseconds on PIT channel 2 and count
+// how far the LAPIC timer and the TSC advance meanwhile.
+static void
+calibrate(void)
+{
+  uint64 t0, t1;
+  uint latch, left;
+
+  latch = PIT_HZ / (1000000 / CALIBUS);
+  outb(PIT_PORTB, (inb(PIT_PORTB) & ~0x02) | 0x01);  // gate on, speaker off
+  outb(PIT_MODE, 0xB0);   // channel 2, lobyte/hibyte, mode 0
+  outb(PIT_CH2, latch & 0xFF);
+  outb(PIT_CH2, latch >> 8);
+
+  lapictimer(0xFFFFFFFF);
+  t0 = rdtsc();
+  while((inb(PIT_PORTB) & 0x20) == 0)
+    ;
+  t1 = rdtsc();
+  left = lapictimercount();
+  lapictimer(0);
+
+  lapicperus = (0xFFFFFFFF - left) / CALIBUS;
+  tscperus = (uint)(t1 - t0) / CALIBUS;
+  if(lapicperus == 0 || tscperus == 0){
+    // No PIT (or no LAPIC); assume the old 10^7 counts per tick.
+    cprintf("timer: calibration failed\n");
+    lapicperus = tscperus = 10000000 / TICKUS;
+  }
+  tscboot = t0;
+}
+
+// Microseconds since timerinit().
+uint64
+microtime(void)
+{
+  return div64(rdtsc() - tscboot, tscperus, 0);
+}
+
+void
+clockread(struct timespec *ts)
+{
+  uint us;
+
+  ts->sec = div64(microtime(), 1000000, &us);
+  ts->nsec = us * 1000;
+}
+
+// Program c's timer for its next event.  Caller holds timerlock.
+static void
+timerarm(struct cpu *c, uint64 now)
+{
+  uint64 next, count;
+
+  if(c->tickless){
+    if(c->timerq == 0){
+      lapictimer(0);
+      return;
+    }
+    next = c->timerq->deadline;
+  } else {
+    next = c->nexttick;
+    if(c->timerq && c->timerq->deadline < next)
+      next = c->timerq->deadline;
+  }
+  count = next > now ? (next - now) * lapicperus : 1;
+  if(count > 0xFFFFFFFF)
+    count = 0xFFFFFFFF;
+  lapictimer(count);
+}
+
+static void
+timerinsert(struct cpu *c, struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &c->timerq; *pp && (*pp)->deadline <= p->deadline; pp = &(*pp)->tnext)
+    ;
+  p->tnext = *pp;
+  *pp = p;
+  p->timercpu = c;
+}
+
+static void
+timerremove(struct proc *p)
+{
+  struct proc **pp;
+
+  if(p->timercpu == 0)
+    return;
+  for(pp = &p->timercpu->timerq; *pp; pp = &(*pp)->tnext){
+    if(*pp == p){
+      *pp = p->tnext;
+      break;
+    }
+  }
+  p->tnext = 0;
+  p->timercpu = 0;
+}
+
+// Called by each CPU after lapicinit(); the first call calibrates.
+void
+timerinit(void)
+{
+  struct cpu *c;
+
+  if(tscperus == 0){
+    initlock(&timerlock, "timer");
+    calibrate();
+  }
+  acquire(&timerlock);
+  c = mycpu();
+  c->nexttick = microtime() + TICKUS;
+  timerarm(c, microtime());
+  release(&timerlock);
+}
+
+// LAPIC timer interrupt.  Wake processes whose deadline has
+// passed and rearm.  Returns 1 if a scheduler tick is due.
+int
+timerintr(void)
+{
+  struct cpu *c;
+  struct proc *p;
+  uint64 now;
+  int tick;
+
+  acquire(&timerlock);
+  c = mycpu();
+  now = microtime();
+  while((p = c->timerq) != 0 && p->deadline <= now){
+    timerremove(p);
+    wakeup(&p->deadline);
+  }
+  tick = 0;
+  if(!c->tickless && c->nexttick <= now){
+    tick = 1;
+    c->nexttick += TICKUS;
+    if(c->nexttick <= now)
+      c->nexttick = now + TICKUS;
+  }
+  timerarm(c, now);
+  release(&timerlock);
+  return tick;
+}
+
+// scheduler() is about to halt with interrupts off.
+void
+timeridle(void)
+{
+  struct cpu *c;
+
+  if(!TICKLESS || cpuid() == 0)
+    return;
+  acquire(&timerlock);
+  c = mycpu();
+  c->tickless = 1;
+  c->idlestart = microtime();
+  timerarm(c, c->idlestart);
+  release(&timerlock);
+}
+
+// scheduler() woke from a halt; restart the tick and
+// charge the time it was stopped as idle.
+void
+timerbusy(void)
+{
+  struct cpu *c;
+  uint64 now;
+
+  acquire(&timerlock);
+  c = mycpu();
+  if(c->tickless){
+    now = microtime();
+    c->idleticks += div64(now - c->idlestart, TICKUS, 0);
+    c->tickless = 0;
+    c->nexttick = now + TICKUS;
+    timerarm(c, now);
+  }
+  release(&timerlock);
+}
+
+// Sleep on &p->deadline, releasing lk as sleep() does, until
+// woken or until microtime() reaches deadline, for waits that
+// other events can also end.  Caller holds lk, so this CPU,
+// whose queue the timer goes on, cannot miss the wakeup.
+void
+timedsleep(uint64 deadline, struct spinlock *lk)
+{
+  struct proc *p = myproc();
+
+  acquire(&timerlock);
+  p->deadline = deadline;
+  timerinsert(mycpu(), p);
+  if(mycpu()->timerq == p)
+    timerarm(mycpu(), microtime());
+  release(&timerlock);
+  sleep(&p->deadline, lk);
+  acquire(&timerlock);
+  timerremove(p);
+  release(&timerlock);
+}
+
+// Sleep for at least us microseconds.
+int
+timersleep(uint64 us)
+{
+  struct proc *p = myproc();
+
+  acquire(&timerlock);
+  p->deadline = microtime() + us;
+  timerinsert(mycpu(), p);
+  if(mycpu()->timerq == p)
+    timerarm(mycpu(), microtime());
+  while(p->timercpu){
+    if(p->killed){
+      timerremove(p);
+      release(&timerlock);
+      return -1;
+    }
+    sleep(&p->deadline, &timerlock);
+  }
+  release(&timerlock);
+  return 0;
+}
@@ -37,6 +37,7 @@ idtinit(void)
 void
 trap(struct trapframe *tf)
 {
+  int tick;
 
   if(tf->trapno == T_SYSCALL){
     if(myproc()->killed)
@@ -48,20 +49,45 @@ trap(struct trapframe *tf)
     return;
   }
 
+  tick = 0;
   switch(tf->trapno){
   case T_IRQ0 + IRQ_TIMER:
+    // The one-shot timer also fires for timersleep() deadlines
+    // that fall between ticks.
+    if(!timerintr()){
+      lapiceoi();
+      break;
+    }
+    tick = 1;
     if(cpuid() == 0){
       acquire(&tickslock);
       ticks++;
       wakeup(&ticks);
       release(&tickslock);
     }
+    if(myproc()){
+      mycpu()->busyticks++;
+      if((tf->cs&3) == DPL_USER)
+        myproc()->utime++;
+      else
+        myproc()->stime++;
+    } else
+      mycpu()->idleticks++;
+    lapiceoi();
+    break;
+  case T_IRQ0 + IRQ_RESCHED:
+    // Sent by makerunnable(); scheduler() rescans on return.
+    mycpu()->halted = 0;
     lapiceoi();
     break;
   case T_IRQ0 + IRQ_IDE:
     ideintr();
     lapiceoi();
     break;
+  case T_IRQ0 + IRQ_VIRTIO:
+    virtiointr();
+    lapiceoi();
+    break;
   case T_IRQ0 + IRQ_IDE+1:
     // Bochs generates spurious IDE1 interrupts.
     break;
@@ -80,14 +106,19 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
   case T_PGFLT:
+  	// The group lock keeps the wmap list still, and keeps a
+  	// sibling thread from mapping the same page meanwhile.
+  	acquiresleep(&myproc()->group->lock);
   	if(tf->err & 1){
-  		struct lazy* temp = myproc()->head;
+  		struct lazy* temp = myproc()->group->head;
   		uint fault = rcr2();
   		fault = PGROUNDDOWN(fault);
   		while(temp) {
   			uint end = temp->addr + temp->length - 1;
   			if(fault >= temp->addr && fault <= end) {
   				pte_t *pte = walkpgdir(myproc()->pgdir, (char *)fault, 0);
+  				if(pte == 0 || (*pte & PTE_P) == 0 || (*pte & PTE_W))
+  					break;  // a sibling got here first
   				uint flags = PTE_FLAGS(*pte);
   				flags |= PTE_W;
   				char* buf = P2V(PTE_ADDR(*pte));
@@ -104,7 +135,7 @@ trap(struct trapframe *tf)
   			temp = temp->next;
   		}
   	} else {
-	    struct lazy* temp = myproc()->head;
+	    struct lazy* temp = myproc()->group->head;
 	    uint fault = rcr2();
 	    fault = PGROUNDDOWN(fault);
 	    int found = 0;
@@ -112,6 +143,9 @@ trap(struct trapframe *tf)
 	      uint end = temp->addr + temp->length - 1;
 	      if(fault >= temp->addr && fault <= end) {
 	      	found = 1;
+	      	pte_t *pte = walkpgdir(myproc()->pgdir, (char *)fault, 0);
+	      	if(pte && (*pte & PTE_P))
+	      		break;  // a sibling got here first
 	        temp->numPages++;
 	      	char *mem = kalloc();
 	       	memset(mem, 0, PGSIZE);
@@ -120,9 +154,8 @@ trap(struct trapframe *tf)
 	      	if(temp->fd == -1) {
 	      		mappages(myproc()->pgdir, (char*)fault, PGSIZE, V2P(mem), PTE_W | PTE_U);
 	      	} else {
-	      		struct file *f = myproc()->ofile[temp->fd];
-	      		f->off = fault - temp->addr;
-	      		fileread(f, mem, PGSIZE);
+	      		struct file *f = myproc()->group->ofile[temp->fd];
+	      		filepread(f, mem, PGSIZE, fault - temp->addr);
 	      		mappages(myproc()->pgdir, (char*)fault, PGSIZE, V2P(mem), PTE_W | PTE_U);
 	      	}
 	      	break;
@@ -130,10 +163,12 @@ trap(struct trapframe *tf)
 	      temp = temp->next;
 		}
 	   	if(found == 0) {
+		  releasesleep(&myproc()->group->lock);
 		  cprintf("Segmentation Fault\n");
 		  exit();
 		}
 	}
+  	releasesleep(&myproc()->group->lock);
 	break;
 
 
@@ -162,7 +197,7 @@ trap(struct trapframe *tf)
   // Force process to give up CPU on clock tick.
   // If interrupts were on while locks held, would need to check nlock.
   if(myproc() && myproc()->state == RUNNING &&
-     tf->trapno == T_IRQ0+IRQ_TIMER)
+     tf->trapno == T_IRQ0+IRQ_TIMER && tick)
     yield();
 
   // Check if the process has been killed since we yielded
@@ -34,5 +34,7 @@
 #define IRQ_COM1         4
 #define IRQ_IDE         14
 #define IRQ_ERROR       19
+#define IRQ_VIRTIO      20      // virtio-blk's PCI line, via ioapicroute()
+#define IRQ_RESCHED     30      // IPI to wake a halted CPU
 #define IRQ_SPURIOUS    31
 
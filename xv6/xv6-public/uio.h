@@ -0,0 +1,13 @@
+#ifndef UIO_H
+#define UIO_H
+
+// Vectored I/O.
+
+// for `readv` and `writev`
+#define IOV_MAX 16
+struct iovec {
+	void *iov_base;			  // Start of a buffer
+	int iov_len;			  // Its length in bytes
+};
+
+#endif /* UIO_H */
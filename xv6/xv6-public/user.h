@@ -1,6 +1,10 @@
 #include "wmap.h"
+#include "pstat.h"
+#include "poll.h"
+#include "uio.h"
 struct stat;
 struct rtcdate;
+struct timespec;
 
 // system calls
 int fork(void);
@@ -29,6 +33,24 @@ int wunmap(uint addr);
 uint wremap(uint oldaddr, int oldsize, int newsize, int flags);
 int getpgdirinfo(struct pgdirinfo *pdinfo); 
 int getwmapinfo(struct wmapinfo *wminfo); 
+int clone(void(*fcn)(void*), void *arg, void *stack);
+int join(void **stack);
+int futex_wait(int *addr, int val);
+int futex_wake(int *addr, int n);
+int getcpustat(struct cpustat *cs);
+int getprocinfo(struct procinfo *pi, int n);
+int nanosleep(const struct timespec *req);
+int clock_gettime(int clk, struct timespec *ts);
+int getbcachestat(struct bcachestat *st);
+int fsync(int fd);
+int pread(int fd, void *buf, int n, int off);
+int pwrite(int fd, const void *buf, int n, int off);
+int readv(int fd, const struct iovec *iov, int cnt);
+int writev(int fd, const struct iovec *iov, int cnt);
+int sendfile(int outfd, int infd, int off, int n);
+int fcntl(int fd, int cmd, int arg);
+int vmsplice(int fd, void *addr, int n);
+int poll(struct pollfd *fds, int n, int timeout);
 
 // ulib.c
 int stat(const char*, struct stat*);
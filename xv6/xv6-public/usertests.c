@@ -7,6 +7,7 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "date.h"
 
 char buf[8192];
 char name[3];
@@ -184,6 +185,11 @@ writetest(void)
   printf(stdout, "small file test ok\n");
 }
 
+// MAXFILE blocks would not fit on the disk; write enough
+// BSIZE records to go well into the double-indirect blocks.
+// Even at 4096-byte blocks this stays under FSSIZE.
+#define BIGBLOCKS (NDIRECT + NINDIRECT + 256)
+
 void
 writetest1(void)
 {
@@ -197,9 +203,9 @@ writetest1(void)
     exit();
   }
 
-  for(i = 0; i < MAXFILE; i++){
+  for(i = 0; i < BIGBLOCKS; i++){
     ((int*)buf)[0] = i;
-    if(write(fd, buf, 512) != 512){
+    if(write(fd, buf, BSIZE) != BSIZE){
       printf(stdout, "error: write big file failed\n", i);
       exit();
     }
@@ -215,14 +221,14 @@ writetest1(void)
 
   n = 0;
   for(;;){
-    i = read(fd, buf, 512);
+    i = read(fd, buf, BSIZE);
     if(i == 0){
-      if(n == MAXFILE - 1){
+      if(n != BIGBLOCKS){
         printf(stdout, "read only %d blocks from big", n);
         exit();
       }
       break;
-    } else if(i != 512){
+    } else if(i != BSIZE){
       printf(stdout, "read failed %d\n", i);
       exit();
     }
@@ -354,6 +360,587 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// threads made by clone() share memory and are collected by join()
+volatile int clonecount;
+
+void
+clonechild(void *arg)
+{
+  clonecount += (int)arg;
+  exit();
+}
+
+void
+clonetest(void)
+{
+  void *stack, *jstack;
+  int pid;
+
+  printf(stdout, "clone test\n");
+  stack = sbrk(4096);
+  clonecount = 0;
+  pid = clone(clonechild, (void*)5, stack);
+  if(pid < 0){
+    printf(stdout, "clone failed\n");
+    exit();
+  }
+  if(join(&jstack) != pid || jstack != stack){
+    printf(stdout, "join failed\n");
+    exit();
+  }
+  if(clonecount != 5){
+    printf(stdout, "clone: thread did not share memory\n");
+    exit();
+  }
+  if(join(&jstack) != -1){
+    printf(stdout, "join with no threads succeeded\n");
+    exit();
+  }
+  printf(stdout, "clone test ok\n");
+}
+
+// a thread blocked in futex_wait() is released by futex_wake()
+volatile int futexval;
+
+void
+futexchild(void *arg)
+{
+  while(futexval == 0)
+    futex_wait((int*)&futexval, 0);
+  futexval = 2;
+  exit();
+}
+
+void
+futextest(void)
+{
+  void *stack;
+  int pid;
+
+  printf(stdout, "futex test\n");
+  if(futex_wait((int*)&futexval, 1) != -1){
+    printf(stdout, "futex_wait on changed word slept\n");
+    exit();
+  }
+  stack = sbrk(4096);
+  futexval = 0;
+  pid = clone(futexchild, 0, stack);
+  if(pid < 0){
+    printf(stdout, "clone failed\n");
+    exit();
+  }
+  sleep(1);
+  futexval = 1;
+  futex_wake((int*)&futexval, 1);
+  if(join(&stack) != pid || futexval != 2){
+    printf(stdout, "futex wake failed\n");
+    exit();
+  }
+  printf(stdout, "futex test ok\n");
+}
+
+// fsync must return with the write committed, and
+// rejects a bad descriptor.
+void
+fsynctest(void)
+{
+  int fd;
+
+  printf(stdout, "fsync test\n");
+  fd = open("fsyncfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "x", 1) != 1){
+    printf(stdout, "create fsyncfile failed\n");
+    exit();
+  }
+  if(fsync(fd) != 0 || fsync(-1) != -1){
+    printf(stdout, "fsync failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("fsyncfile");
+  printf(stdout, "fsync test ok\n");
+}
+
+// pread and pwrite use their own offset, not the file's.
+void
+preadtest(void)
+{
+  char buf[4];
+  int fd;
+
+  printf(stdout, "pread test\n");
+  fd = open("preadfile", O_CREATE|O_RDWR);
+  if(fd < 0 || write(fd, "abcdef", 6) != 6){
+    printf(stdout, "create preadfile failed\n");
+    exit();
+  }
+  if(pwrite(fd, "XY", 2, 2) != 2 || pread(fd, buf, 3, 1) != 3 ||
+     buf[0] != 'b' || buf[1] != 'X' || buf[2] != 'Y'){
+    printf(stdout, "pread/pwrite failed\n");
+    exit();
+  }
+  // The file offset is still at the end.
+  if(write(fd, "g", 1) != 1 || pread(fd, buf, 1, 6) != 1 || buf[0] != 'g'){
+    printf(stdout, "pwrite moved the offset\n");
+    exit();
+  }
+  if(pread(fd, buf, 1, 100) != 0){
+    printf(stdout, "pread past end not at eof\n");
+    exit();
+  }
+  close(fd);
+  unlink("preadfile");
+  printf(stdout, "pread test ok\n");
+}
+
+void
+writevtest(void)
+{
+  struct iovec iov[3];
+  char a[4], b[5];
+  int fd, fds[2];
+
+  printf(stdout, "writev test\n");
+  a[3] = b[4] = 0;
+  iov[0].iov_base = "ab";
+  iov[0].iov_len = 2;
+  iov[1].iov_base = "";
+  iov[1].iov_len = 0;
+  iov[2].iov_base = "cdefg";
+  iov[2].iov_len = 5;
+  fd = open("writevfile", O_CREATE|O_RDWR);
+  if(fd < 0 || writev(fd, iov, 3) != 7){
+    printf(stdout, "writev to file failed\n");
+    exit();
+  }
+  close(fd);
+  fd = open("writevfile", 0);
+  iov[0].iov_base = a;
+  iov[0].iov_len = 3;
+  iov[1].iov_base = b;
+  iov[1].iov_len = 4;
+  if(readv(fd, iov, 2) != 7 || strcmp(a, "abc") != 0 || strcmp(b, "defg") != 0){
+    printf(stdout, "readv from file failed\n");
+    exit();
+  }
+  close(fd);
+  unlink("writevfile");
+
+  if(pipe(fds) != 0 || writev(fds[1], iov, 2) != 7){
+    printf(stdout, "writev to pipe failed\n");
+    exit();
+  }
+  iov[0].iov_base = b;
+  iov[0].iov_len = 4;
+  iov[1].iov_base = a;
+  iov[1].iov_len = 3;
+  if(readv(fds[0], iov, 2) != 7 || strcmp(b, "abcd") != 0 || strcmp(a, "efg") != 0){
+    printf(stdout, "readv from pipe failed\n");
+    exit();
+  }
+  iov[0].iov_base = (void*)0x7fffffff;
+  if(writev(fds[1], iov, 1) != -1 || writev(fds[1], iov, IOV_MAX+1) != -1){
+    printf(stdout, "writev took a bad vector\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  printf(stdout, "writev test ok\n");
+}
+
+void
+sendfiletest(void)
+{
+  char buf[8];
+  int fd, out, fds[2];
+
+  printf(stdout, "sendfile test\n");
+  fd = open("sendfile0", O_CREATE|O_RDWR);
+  out = open("sendfile1", O_CREATE|O_RDWR);
+  if(fd < 0 || out < 0 || write(fd, "abcdef", 6) != 6){
+    printf(stdout, "create sendfile files failed\n");
+    exit();
+  }
+  // From an offset, leaving fd's offset at the end.
+  if(sendfile(out, fd, 2, 100) != 4 || sendfile(out, fd, -1, 100) != 0){
+    printf(stdout, "sendfile to file failed\n");
+    exit();
+  }
+  memset(buf, 0, sizeof(buf));
+  if(pread(out, buf, sizeof(buf), 0) != 4 || strcmp(buf, "cdef") != 0){
+    printf(stdout, "sendfile file data wrong\n");
+    exit();
+  }
+  if(pipe(fds) != 0 || sendfile(fds[1], out, 1, 2) != 2 ||
+     sendfile(fds[1], fds[0], -1, 1) != -1){
+    printf(stdout, "sendfile to pipe failed\n");
+    exit();
+  }
+  memset(buf, 0, sizeof(buf));
+  if(read(fds[0], buf, sizeof(buf)) != 2 || strcmp(buf, "de") != 0){
+    printf(stdout, "sendfile pipe data wrong\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fds[1]);
+  close(fd);
+  close(out);
+  unlink("sendfile0");
+  unlink("sendfile1");
+  printf(stdout, "sendfile test ok\n");
+}
+
+// Resizing a pipe keeps what is buffered in it.
+void
+pipesizetest(void)
+{
+  static char buf[6000];
+  int fds[2], i;
+
+  printf(stdout, "pipe size test\n");
+  if(pipe(fds) != 0 || fcntl(fds[0], F_GETPIPE_SZ, 0) != 4096){
+    printf(stdout, "pipe size wrong\n");
+    exit();
+  }
+  for(i = 0; i < 3000; i++)
+    buf[i] = i;
+  if(write(fds[1], buf, 3000) != 3000 ||
+     fcntl(fds[1], F_SETPIPE_SZ, 3*4096) != 4*4096 ||
+     write(fds[1], buf + 3000, 3000) != 3000 ||
+     fcntl(fds[1], F_SETPIPE_SZ, 4096) != -1 ||
+     fcntl(fds[1], F_SETPIPE_SZ, 1 << 30) != -1 ||
+     fcntl(fds[1], F_SETRLOWAT, 0) != -1){
+    printf(stdout, "pipe resize failed\n");
+    exit();
+  }
+  memset(buf, 0, sizeof(buf));
+  if(read(fds[0], buf, sizeof(buf)) != 6000){
+    printf(stdout, "pipe lost data\n");
+    exit();
+  }
+  for(i = 0; i < 3000; i++){
+    if(buf[i] != (char)i || buf[3000+i] != 0){
+      printf(stdout, "pipe data wrong\n");
+      exit();
+    }
+  }
+  close(fds[0]);
+  close(fds[1]);
+  printf(stdout, "pipe size test ok\n");
+}
+
+// Data streams through a pipe with both wakeup thresholds
+// set, as long as they fit in the pipe together.
+void
+pipelowattest(void)
+{
+  static char buf[1000];
+  int fds[2], i, n, total, pid;
+
+  printf(stdout, "pipe lowat test\n");
+  if(pipe(fds) != 0 ||
+     fcntl(fds[0], F_SETRLOWAT, 3000) != 0 ||
+     fcntl(fds[1], F_SETWLOWAT, 2000) != -1 ||
+     fcntl(fds[1], F_SETWLOWAT, 1096) != 0 ||
+     fcntl(fds[0], F_SETRLOWAT, 3001) != -1){
+    printf(stdout, "pipe lowat setup failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    for(total = 0; total < 5*4096; total += sizeof(buf)){
+      for(i = 0; i < sizeof(buf); i++)
+        buf[i] = total + i;
+      if(write(fds[1], buf, sizeof(buf)) != sizeof(buf)){
+        printf(stdout, "pipe lowat write failed\n");
+        exit();
+      }
+    }
+    exit();
+  }
+  close(fds[1]);
+  total = 0;
+  while((n = read(fds[0], buf, sizeof(buf))) > 0){
+    for(i = 0; i < n; i++){
+      if(buf[i] != (char)(total + i)){
+        printf(stdout, "pipe lowat data wrong\n");
+        exit();
+      }
+    }
+    total += n;
+  }
+  wait();
+  if(total != 21*sizeof(buf)){
+    printf(stdout, "pipe lowat read %d\n", total);
+    exit();
+  }
+  close(fds[0]);
+  printf(stdout, "pipe lowat test ok\n");
+}
+
+// Pages given to a pipe with vmsplice come out the other
+// end, and leave zeros behind.
+void
+vmsplicetest(void)
+{
+  char *src, *dst;
+  int fds[2], i, pid;
+
+  printf(stdout, "vmsplice test\n");
+  pid = fork();
+  if(pid == 0){
+    src = (char*)wmap(0x60000000, 2*4096, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1);
+    dst = (char*)wmap(0x60010000, 2*4096, MAP_PRIVATE|MAP_ANONYMOUS|MAP_FIXED, -1);
+    if(src == (char*)-1 || dst == (char*)-1 || pipe(fds) != 0 ||
+       fcntl(fds[1], F_SETPIPE_SZ, 2*4096) != 2*4096){
+      printf(stdout, "vmsplice setup failed\n");
+      exit();
+    }
+    for(i = 0; i < 4096; i++)
+      src[i] = i;
+    if(vmsplice(fds[1], src, 2*4096) != 2*4096 || src[1] != 0 ||
+       vmsplice(fds[1], src + 1, 4096) != -1){
+      printf(stdout, "vmsplice gift failed\n");
+      exit();
+    }
+    if(vmsplice(fds[0], dst, 2*4096) != 2*4096){
+      printf(stdout, "vmsplice take failed\n");
+      exit();
+    }
+    for(i = 0; i < 2*4096; i++){
+      if(dst[i] != (i < 4096 ? (char)i : 0)){
+        printf(stdout, "vmsplice data wrong\n");
+        exit();
+      }
+    }
+    printf(stdout, "vmsplice test ok\n");
+    exit();
+  }
+  wait();
+}
+
+// poll() waits on two pipes at once and wakes for the one
+// that gets data.
+void
+polltest(void)
+{
+  struct pollfd pfd[3];
+  int a[2], b[2], pid;
+  char c;
+
+  printf(stdout, "poll test\n");
+  if(pipe(a) != 0 || pipe(b) != 0){
+    printf(stdout, "pipe() failed\n");
+    exit();
+  }
+  pfd[0].fd = a[0];
+  pfd[0].events = POLLIN;
+  pfd[1].fd = b[0];
+  pfd[1].events = POLLIN;
+  pfd[2].fd = a[1];
+  pfd[2].events = POLLOUT;
+  if(poll(pfd, 3, 0) != 1 || pfd[0].revents || pfd[1].revents ||
+     pfd[2].revents != POLLOUT){
+    printf(stdout, "poll of idle pipes wrong\n");
+    exit();
+  }
+  if(poll(pfd, 2, 20) != 0){
+    printf(stdout, "poll did not time out\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    sleep(2);
+    write(b[1], "x", 1);
+    exit();
+  }
+  if(poll(pfd, 2, -1) != 1 || pfd[0].revents || pfd[1].revents != POLLIN ||
+     read(b[0], &c, 1) != 1 || c != 'x'){
+    printf(stdout, "poll missed a write\n");
+    exit();
+  }
+  wait();
+  close(b[1]);
+  pfd[1].fd = 99;
+  if(poll(pfd + 1, 1, -1) != 1 || pfd[1].revents != POLLNVAL){
+    printf(stdout, "poll of a bad fd wrong\n");
+    exit();
+  }
+  close(a[0]);
+  close(a[1]);
+  close(b[0]);
+  printf(stdout, "poll test ok\n");
+}
+
+// A sequential read of a file longer than the read-ahead
+// window, in pieces that straddle blocks, sees the right data.
+#define RABLOCKS 40
+#define RABYTE(o) ((char)((o)*7 + (o)/BSIZE))
+
+void
+readaheadtest(void)
+{
+  int fd, i, n, off;
+
+  printf(stdout, "readahead test\n");
+  fd = open("rafile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "create rafile failed\n");
+    exit();
+  }
+  for(off = 0; off < RABLOCKS*BSIZE; off += BSIZE){
+    for(i = 0; i < BSIZE; i++)
+      buf[i] = RABYTE(off + i);
+    if(write(fd, buf, BSIZE) != BSIZE){
+      printf(stdout, "write rafile failed\n");
+      exit();
+    }
+  }
+  close(fd);
+
+  fd = open("rafile", O_RDONLY);
+  for(off = 0; (n = read(fd, buf, 700)) > 0; off += n){
+    for(i = 0; i < n; i++){
+      if(buf[i] != RABYTE(off + i)){
+        printf(stdout, "rafile wrong at %d\n", off + i);
+        exit();
+      }
+    }
+  }
+  if(n < 0 || off != RABLOCKS*BSIZE){
+    printf(stdout, "read rafile failed at %d\n", off);
+    exit();
+  }
+  close(fd);
+  unlink("rafile");
+  printf(stdout, "readahead test ok\n");
+}
+
+// A directory that grows past its linear blocks becomes
+// hashed; lookups and removal still work, and it can be
+// removed once empty.  Hard links keep it from using up
+// inodes at large block sizes.
+#define HDNAMES (2*(BSIZE/sizeof(struct dirent)) + 8)
+
+static void
+hdname(char *name, int i)
+{
+  strcpy(name, "hd/x000");
+  name[4] = '0' + i/100;
+  name[5] = '0' + i/10%10;
+  name[6] = '0' + i%10;
+}
+
+void
+hashdirtest(void)
+{
+  char name[16];
+  int fd, i;
+
+  printf(stdout, "hashed dir test\n");
+  if(mkdir("hd") < 0 || (fd = open("hdfile", O_CREATE|O_RDWR)) < 0){
+    printf(stdout, "create hd failed\n");
+    exit();
+  }
+  close(fd);
+  for(i = 0; i < HDNAMES; i++){
+    hdname(name, i);
+    if(link("hdfile", name) < 0){
+      printf(stdout, "link %s failed\n", name);
+      exit();
+    }
+  }
+  for(i = 0; i < HDNAMES; i += 2){
+    hdname(name, i);
+    if(unlink(name) < 0){
+      printf(stdout, "unlink %s failed\n", name);
+      exit();
+    }
+  }
+  for(i = 0; i < HDNAMES; i++){
+    hdname(name, i);
+    fd = open(name, O_RDONLY);
+    if((fd >= 0) != (i % 2 == 1)){
+      printf(stdout, "lookup of %s wrong\n", name);
+      exit();
+    }
+    if(fd >= 0)
+      close(fd);
+  }
+  if(unlink("hd") == 0){
+    printf(stdout, "unlinked non-empty hd\n");
+    exit();
+  }
+  for(i = 1; i < HDNAMES; i += 2){
+    hdname(name, i);
+    if(unlink(name) < 0){
+      printf(stdout, "unlink %s failed\n", name);
+      exit();
+    }
+  }
+  if(unlink("hd") < 0 || unlink("hdfile") < 0){
+    printf(stdout, "unlink empty hd failed\n");
+    exit();
+  }
+  printf(stdout, "hashed dir test ok\n");
+}
+
+// Rereading a small file should come from the buffer cache.
+void
+bcachetest(void)
+{
+  struct bcachestat st0, st1;
+  char buf[64];
+  int fd;
+
+  printf(stdout, "bcache test\n");
+  fd = open("README", 0);
+  if(fd < 0){
+    printf(stdout, "open README failed\n");
+    exit();
+  }
+  read(fd, buf, sizeof(buf));
+  close(fd);
+  getbcachestat(&st0);
+  fd = open("README", 0);
+  read(fd, buf, sizeof(buf));
+  close(fd);
+  getbcachestat(&st1);
+  if(st1.hits <= st0.hits || st1.misses != st0.misses){
+    printf(stdout, "bcache reread missed\n");
+    exit();
+  }
+  printf(stdout, "bcache test ok\n");
+}
+
+// A 2ms nanosleep must not return early.
+void
+nanosleeptest(void)
+{
+  struct timespec t0, t1, req;
+  uint us;
+
+  printf(stdout, "nanosleep test\n");
+  if(clock_gettime(CLOCK_MONOTONIC, &t0) < 0){
+    printf(stdout, "clock_gettime failed\n");
+    exit();
+  }
+  req.sec = 0;
+  req.nsec = 2000000;
+  if(nanosleep(&req) < 0){
+    printf(stdout, "nanosleep failed\n");
+    exit();
+  }
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  us = (t1.sec - t0.sec) * 1000000 + t1.nsec / 1000 - t0.nsec / 1000;
+  if(us < 2000){
+    printf(stdout, "nanosleep woke after %d us\n", us);
+    exit();
+  }
+  printf(stdout, "nanosleep test ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -1783,6 +2370,20 @@ main(int argc, char *argv[])
   pipe1();
   preempt();
   exitwait();
+  clonetest();
+  futextest();
+  nanosleeptest();
+  bcachetest();
+  readaheadtest();
+  hashdirtest();
+  fsynctest();
+  preadtest();
+  writevtest();
+  sendfiletest();
+  pipesizetest();
+  pipelowattest();
+  vmsplicetest();
+  polltest();
 
   rmdot();
   fourteen();
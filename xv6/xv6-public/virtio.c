@@ -0,0 +1,246 @@
+// Driver for a legacy (virtio 0.9.5) virtio-blk PCI device,
+// which stands in for IDE disk 1 when QEMU provides one
+// (make DISK=virtio).  ide.c hands it requests from idesubmit().
+//
+// Each request is a chain of three descriptors (header, data,
+// status) in a single split virtqueue, so up to NUM/3 requests
+// are in flight at once and complete in any order.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+
+#define VIRTIO_VENDOR   0x1AF4
+#define VIRTIO_BLK      0x1001   // transitional block device
+
+// Legacy I/O registers, at offsets from BAR0.
+#define VIO_FEATURES    0x00
+#define VIO_GFEATURES   0x04
+#define VIO_QPFN        0x08     // queue address >> 12
+#define VIO_QSIZE       0x0C
+#define VIO_QSEL        0x0E
+#define VIO_QNOTIFY     0x10
+#define VIO_STATUS      0x12
+  #define VIO_ACK         1
+  #define VIO_DRIVER      2
+  #define VIO_DRIVER_OK   4
+#define VIO_ISR         0x13     // reading clears the interrupt
+
+#define VRING_NEXT      1        // chained to desc.next
+#define VRING_WRITE     2        // device writes (vs reads)
+
+#define VBLK_IN         0        // read the disk
+#define VBLK_OUT        1        // write the disk
+
+#define NUM             256      // largest queue this driver lays out
+
+struct vdesc {
+  uint64 addr;
+  uint len;
+  ushort flags;
+  ushort next;
+};
+
+struct vused {
+  uint id;                       // head of the completed chain
+  uint len;
+};
+
+struct vblkreq {
+  uint type;
+  uint reserved;
+  uint64 sector;
+};
+
+// The ring must be physically contiguous, so it is
+// in the kernel's bss rather than in kalloc() pages.
+static char vqmem[3*PGSIZE] __attribute__((aligned(PGSIZE)));
+
+static struct {
+  struct spinlock lock;
+  ushort iobase;
+  int num;                       // queue size set by the device
+  struct vdesc *desc;
+  volatile ushort *avail;        // flags, idx, ring[num]
+  volatile ushort *usedidx;
+  volatile struct vused *used;
+  ushort lastused;
+  char free[NUM];                // is a descriptor free?
+  int nfree;
+  struct {
+    struct buf *b;
+    struct vblkreq req;
+    uchar status;
+  } info[NUM];                   // indexed by chain head
+} vdisk;
+
+// Find and set up the device; return -1 if there is none.
+int
+virtioinit(void)
+{
+  struct pcidev pd;
+  uint usedoff;
+  int i;
+
+  if(pcifind(VIRTIO_VENDOR, VIRTIO_BLK, PCI_ANY, PCI_ANY, &pd) < 0 || (pd.bar[0] & 1) == 0)
+    return -1;
+  pcienable(&pd);
+  initlock(&vdisk.lock, "virtio");
+  vdisk.iobase = pd.bar[0] & ~3;
+
+  outb(vdisk.iobase + VIO_STATUS, 0);  // reset
+  outb(vdisk.iobase + VIO_STATUS, VIO_ACK | VIO_DRIVER);
+  outl(vdisk.iobase + VIO_GFEATURES, 0);
+
+  // Lay out the descriptors, the available ring, and, on the
+  // next page boundary, the used ring.
+  outw(vdisk.iobase + VIO_QSEL, 0);
+  vdisk.num = inw(vdisk.iobase + VIO_QSIZE);
+  usedoff = PGROUNDUP(vdisk.num*sizeof(struct vdesc) + (3 + vdisk.num)*sizeof(ushort));
+  if(vdisk.num == 0 || vdisk.num > NUM ||
+     usedoff + 3*sizeof(ushort) + vdisk.num*sizeof(struct vused) > sizeof(vqmem)){
+    cprintf("virtio: unusable queue size %d\n", vdisk.num);
+    outb(vdisk.iobase + VIO_STATUS, 0);
+    return -1;
+  }
+  memset(vqmem, 0, sizeof(vqmem));
+  vdisk.desc = (struct vdesc*)vqmem;
+  vdisk.avail = (ushort*)(vqmem + vdisk.num*sizeof(struct vdesc));
+  vdisk.usedidx = (ushort*)(vqmem + usedoff) + 1;
+  vdisk.used = (struct vused*)(vqmem + usedoff + 2*sizeof(ushort));
+  for(i = 0; i < vdisk.num; i++)
+    vdisk.free[i] = 1;
+  vdisk.nfree = vdisk.num;
+  outl(vdisk.iobase + VIO_QPFN, V2P(vqmem) / PGSIZE);
+
+  outb(vdisk.iobase + VIO_STATUS, VIO_ACK | VIO_DRIVER | VIO_DRIVER_OK);
+  ioapicroute(pd.irq, T_IRQ0 + IRQ_VIRTIO, ncpu - 1);
+  return 0;
+}
+
+// Take a free descriptor.  Caller holds vdisk.lock
+// and has checked nfree.
+static int
+allocdesc(void)
+{
+  int i;
+
+  for(i = 0; i < vdisk.num; i++){
+    if(vdisk.free[i]){
+      vdisk.free[i] = 0;
+      vdisk.nfree--;
+      return i;
+    }
+  }
+  panic("virtio: allocdesc");
+}
+
+static void
+freechain(int i)
+{
+  for(;;){
+    vdisk.free[i] = 1;
+    vdisk.nfree++;
+    if((vdisk.desc[i].flags & VRING_NEXT) == 0)
+      break;
+    i = vdisk.desc[i].next;
+  }
+}
+
+// Queue a request for b.  Caller holds vdisk.lock.
+static void
+virtioqueue(struct buf *b)
+{
+  int d[3], i;
+
+  while(vdisk.nfree < 3){
+    // Make sure what is queued already can complete.
+    outw(vdisk.iobase + VIO_QNOTIFY, 0);
+    sleep(&vdisk.nfree, &vdisk.lock);
+  }
+  for(i = 0; i < 3; i++)
+    d[i] = allocdesc();
+
+  vdisk.info[d[0]].b = b;
+  vdisk.info[d[0]].req.type = (b->flags & B_DIRTY) ? VBLK_OUT : VBLK_IN;
+  vdisk.info[d[0]].req.reserved = 0;
+  vdisk.info[d[0]].req.sector = (uint64)b->blockno * (BSIZE/512);
+  vdisk.info[d[0]].status = 0xFF;
+
+  vdisk.desc[d[0]].addr = V2P(&vdisk.info[d[0]].req);
+  vdisk.desc[d[0]].len = sizeof(struct vblkreq);
+  vdisk.desc[d[0]].flags = VRING_NEXT;
+  vdisk.desc[d[0]].next = d[1];
+
+  vdisk.desc[d[1]].addr = V2P(b->data);
+  vdisk.desc[d[1]].len = BSIZE;
+  vdisk.desc[d[1]].flags = VRING_NEXT | ((b->flags & B_DIRTY) ? 0 : VRING_WRITE);
+  vdisk.desc[d[1]].next = d[2];
+
+  vdisk.desc[d[2]].addr = V2P(&vdisk.info[d[0]].status);
+  vdisk.desc[d[2]].len = 1;
+  vdisk.desc[d[2]].flags = VRING_WRITE;
+  vdisk.desc[d[2]].next = 0;
+
+  // Publish the chain, then the new index.
+  vdisk.avail[2 + vdisk.avail[1] % vdisk.num] = d[0];
+  __sync_synchronize();
+  vdisk.avail[1]++;
+}
+
+// Queue all of bufs and tell the device once.
+void
+virtiosubmit(struct buf **bufs, int n)
+{
+  int i;
+
+  acquire(&vdisk.lock);
+  for(i = 0; i < n; i++)
+    virtioqueue(bufs[i]);
+  __sync_synchronize();
+  outw(vdisk.iobase + VIO_QNOTIFY, 0);
+  release(&vdisk.lock);
+}
+
+void
+virtiowait(struct buf *b)
+{
+  acquire(&vdisk.lock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    sleep(b, &vdisk.lock);
+  release(&vdisk.lock);
+}
+
+void
+virtiointr(void)
+{
+  struct buf *b;
+  int id;
+
+  acquire(&vdisk.lock);
+  inb(vdisk.iobase + VIO_ISR);  // deassert before scanning
+
+  while(vdisk.lastused != *vdisk.usedidx){
+    __sync_synchronize();
+    id = vdisk.used[vdisk.lastused % vdisk.num].id;
+    if(vdisk.info[id].status != 0)
+      panic("virtio: request failed");
+    b = vdisk.info[id].b;
+    freechain(id);
+    biodone(b);
+    vdisk.lastused++;
+  }
+  wakeup(&vdisk.nfree);
+
+  release(&vdisk.lock);
+}
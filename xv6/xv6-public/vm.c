@@ -416,6 +416,67 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
   return 0;
 }
 
+// Return the current process's anonymous wmap region that
+// holds all of [va, va+n), or 0 if there is none.
+struct lazy*
+wmapregion(uint va, uint n)
+{
+  struct lazy *r;
+
+  for(r = myproc()->group->head; r; r = r->next){
+    if(r->used && r->fd == -1 && va >= r->addr &&
+       va + n >= va && va + n <= r->addr + r->length)
+      return r;
+  }
+  return 0;
+}
+
+// Return the kernel address of the page at va in region r,
+// first mapping a zeroed page there if none is.
+char*
+wmappage(struct lazy *r, uint va)
+{
+  pte_t *pte;
+  char *mem;
+
+  if((pte = walkpgdir(myproc()->pgdir, (char*)va, 1)) == 0)
+    return 0;
+  if(*pte & PTE_P)
+    return P2V(PTE_ADDR(*pte));
+  if((mem = kalloc()) == 0)
+    return 0;
+  memset(mem, 0, PGSIZE);
+  *pte = V2P(mem) | PTE_W | PTE_U | PTE_P;
+  r->numPages++;
+  return mem;
+}
+
+// Replace the page at va in region r with mem, or with
+// nothing if mem is 0, and return the page that was there.
+// Only this CPU's TLB is flushed, so the caller must be the
+// group's only live thread; the page table entry was the
+// last reference to an anonymous region's page, and the
+// caller now owns it.
+char*
+wmapswap(struct lazy *r, uint va, char *mem)
+{
+  pte_t *pte;
+  char *old;
+
+  pte = walkpgdir(myproc()->pgdir, (char*)va, 0);
+  old = (pte && (*pte & PTE_P)) ? P2V(PTE_ADDR(*pte)) : 0;
+  if(mem){
+    if(old == 0)
+      panic("wmapswap");
+    *pte = V2P(mem) | PTE_W | PTE_U | PTE_P;
+  } else if(old){
+    *pte = 0;
+    r->numPages--;
+  }
+  lcr3(V2P(myproc()->pgdir));
+  return old;
+}
+
 //PAGEBREAK!
 // Blank page.
 //PAGEBREAK!
@@ -9,6 +9,24 @@ inb(ushort port)
   return data;
 }
 
+static inline ushort
+inw(ushort port)
+{
+  ushort data;
+
+  asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
+static inline uint
+inl(ushort port)
+{
+  uint data;
+
+  asm volatile("in %1,%0" : "=a" (data) : "d" (port));
+  return data;
+}
+
 static inline void
 insl(int port, void *addr, int cnt)
 {
@@ -30,6 +48,12 @@ outw(ushort port, ushort data)
   asm volatile("out %0,%1" : : "a" (data), "d" (port));
 }
 
+static inline void
+outl(ushort port, uint data)
+{
+  asm volatile("out %0,%1" : : "a" (data), "d" (port));
+}
+
 static inline void
 outsl(int port, const void *addr, int cnt)
 {
@@ -117,6 +141,24 @@ sti(void)
   asm volatile("sti");
 }
 
+// Enable interrupts and wait for one.  sti holds off interrupts
+// until after the next instruction, so one that is already
+// pending ends the hlt instead of being taken just before it.
+static inline void
+stihlt(void)
+{
+  asm volatile("sti; hlt");
+}
+
+static inline uint64
+rdtsc(void)
+{
+  uint64 tsc;
+
+  asm volatile("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 static inline uint
 xchg(volatile uint *addr, uint newval)
 {